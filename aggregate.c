@@ -0,0 +1,76 @@
+/*
+ *   Multimeter measurement
+ *   Windowed sample statistics
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "aggregate.h"
+
+#include <string.h>
+#include <math.h>
+
+
+void aggregate_reset(struct aggregate *agg)
+{
+	memset(agg, 0, sizeof(*agg));
+}
+
+bool aggregate_fits(const struct aggregate *agg,
+		    const struct es51984_sample *sample)
+{
+	if (!agg->active)
+		return true;
+	return sample->function == agg->mode.function &&
+	       sample->range == agg->mode.range &&
+	       sample->dc_mode == agg->mode.dc_mode;
+}
+
+void aggregate_add(struct aggregate *agg,
+		   const struct es51984_sample *sample)
+{
+	double delta;
+
+	if (!agg->active) {
+		agg->mode = *sample;
+		agg->active = true;
+	}
+	if (sample->batt_low)
+		agg->batt_low = true;
+	if (sample->overflow) {
+		agg->overflows++;
+		return;
+	}
+
+	if (agg->count == 0) {
+		agg->min = sample->value;
+		agg->max = sample->value;
+	} else {
+		if (sample->value < agg->min)
+			agg->min = sample->value;
+		if (sample->value > agg->max)
+			agg->max = sample->value;
+	}
+	/* Welford's online algorithm. Stable for long windows. */
+	agg->count++;
+	delta = sample->value - agg->mean;
+	agg->mean += delta / (double)agg->count;
+	agg->m2 += delta * (sample->value - agg->mean);
+}
+
+double aggregate_stddev(const struct aggregate *agg)
+{
+	if (agg->count < 2)
+		return 0.0;
+	return sqrt(agg->m2 / (double)(agg->count - 1));
+}
@@ -0,0 +1,59 @@
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+/* Windowed sample statistics. */
+
+#include "es51984.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/** struct aggregate - Statistics of the samples in one window.
+ *
+ * All samples in a window have the same function, range and AC/DC mode.
+ * Overflow samples are counted, but don't contribute to the statistics.
+ *
+ * @mode: The first sample of the window. Its mode describes the window.
+ * @count: The number of samples with a value.
+ * @overflows: The number of overflow samples.
+ * @min: The smallest value.
+ * @max: The largest value.
+ * @mean: The running mean of the values.
+ * @m2: The running sum of squared deviations from the mean.
+ * @batt_low: Boolean. Any sample had the battery low condition.
+ * @active: Boolean. The window holds at least one sample.
+ */
+struct aggregate {
+	struct es51984_sample mode;
+	uint64_t count;
+	uint64_t overflows;
+	double min;
+	double max;
+	double mean;
+	double m2;
+	bool batt_low;
+	bool active;
+};
+
+/** aggregate_reset - Start an empty window. */
+void aggregate_reset(struct aggregate *agg);
+
+/** aggregate_fits - Check whether a sample belongs to the window.
+ * Returns false, if the window has to be closed before the sample
+ * can be added, because the mode of the meter changed.
+ */
+bool aggregate_fits(const struct aggregate *agg,
+		    const struct es51984_sample *sample);
+
+/** aggregate_add - Add a sample to the window.
+ * The sample must fit (see aggregate_fits()).
+ */
+void aggregate_add(struct aggregate *agg,
+		   const struct es51984_sample *sample);
+
+/** aggregate_stddev - Get the sample standard deviation of the window. */
+double aggregate_stddev(const struct aggregate *agg);
+
+
+#endif /* AGGREGATE_H_ */
@@ -0,0 +1,74 @@
+/*
+ *   Multimeter measurement
+ *   Change-only sample filter
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "deadband.h"
+
+#include <string.h>
+#include <math.h>
+
+
+void deadband_init(struct deadband *db, double absolute, double relative,
+		   int64_t heartbeat_ns)
+{
+	memset(db, 0, sizeof(*db));
+	db->absolute = absolute;
+	db->relative = relative;
+	db->heartbeat_ns = heartbeat_ns;
+}
+
+/* Check whether anything but the value changed. */
+static bool flags_changed(const struct es51984_sample *a,
+			  const struct es51984_sample *b)
+{
+	return a->function != b->function ||
+	       a->range != b->range ||
+	       a->overflow != b->overflow ||
+	       a->hold != b->hold ||
+	       a->batt_low != b->batt_low ||
+	       a->dc_mode != b->dc_mode ||
+	       a->auto_mode != b->auto_mode ||
+	       a->degree != b->degree;
+}
+
+bool deadband_pass(struct deadband *db, const struct es51984_sample *sample)
+{
+	const struct es51984_sample *last = &db->last;
+	double delta;
+
+	if (!db->active)
+		goto pass;
+	if (flags_changed(sample, last))
+		goto pass;
+	if (db->heartbeat_ns > 0 &&
+	    sample->mono_ns - last->mono_ns >= db->heartbeat_ns)
+		goto pass;
+	if (sample->overflow)
+		return false; /* No value to compare. */
+
+	/* The value is compared to the last passed one, not to the
+	 * previous sample. A slow drift can't hide in the deadband.
+	 * The change must leave both bands. */
+	delta = fabs(sample->value - last->value);
+	if (delta > db->absolute && delta > db->relative * fabs(last->value))
+		goto pass;
+
+	return false;
+pass:
+	db->last = *sample;
+	db->active = true;
+	return true;
+}
@@ -0,0 +1,52 @@
+#ifndef DEADBAND_H_
+#define DEADBAND_H_
+
+/* Change-only sample filter. */
+
+#include "es51984.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/** struct deadband - Deadband filter state.
+ *
+ * @absolute: Minimum absolute value change to pass.
+ * @relative: Minimum value change to pass, relative to the last value.
+ * @heartbeat_ns: Pass a sample at least this often. 0 disables this.
+ * @last: The last sample that passed.
+ * @active: Boolean. A sample passed already.
+ */
+struct deadband {
+	double absolute;
+	double relative;
+	int64_t heartbeat_ns;
+
+	struct es51984_sample last;
+	bool active;
+};
+
+/** deadband_init - Initialize a deadband filter.
+ * A sample passes, if its value differs from the last passed value
+ * by more than absolute and by more than relative * |last value|.
+ * So the wider of the two bands applies. The absolute band keeps
+ * noise around zero out, where the relative band vanishes.
+ * Both limits may be 0 to pass every change.
+ *
+ * @db: The filter.
+ * @absolute: Absolute deadband.
+ * @relative: Relative deadband. 0.01 is 1%.
+ * @heartbeat_ns: Heartbeat interval in nanoseconds, or 0.
+ */
+void deadband_init(struct deadband *db, double absolute, double relative,
+		   int64_t heartbeat_ns);
+
+/** deadband_pass - Check whether a sample has to be output.
+ * Returns true for samples outside of the deadband, for samples with
+ * changed flags and for heartbeats. The sample becomes the new
+ * reference then.
+ */
+bool deadband_pass(struct deadband *db, const struct es51984_sample *sample);
+
+
+#endif /* DEADBAND_H_ */
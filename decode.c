@@ -0,0 +1,414 @@
+/*
+ *   Multimeter measurement
+ *   Parallel offline decoder
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "decode.h"
+#include "output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/* Amount of input per chunk. */
+#define CHUNK_BYTES		(4u * 1024u * 1024u)
+/* Number of frames decoded per es51984_decode_frames() call. */
+#define BATCH_FRAMES		256u
+/* Maximum length of one output line. */
+#define LINE_MAX_LEN		256u
+
+struct decode_chunk {
+	size_t start;		/* Offset of the first byte or record */
+	size_t end;		/* Offset past the last byte or record */
+	bool done;		/* Decoding finished */
+	char *out;		/* Decoded text */
+	size_t out_len;
+	size_t out_size;
+	unsigned long nr_frames;	/* Decoded frames */
+	unsigned long nr_invalid;	/* Rejected frames */
+	int err;
+};
+
+struct decode_ctx {
+	const uint8_t *data;	/* The mapped file, after the header */
+	size_t size;		/* Size of the data in bytes */
+	bool capture;		/* Capture records or raw stream */
+	enum es51984_board_type board;
+	bool csv;
+	bool binary;
+	enum output_timestamp timestamp;
+
+	struct decode_chunk *chunks;
+	size_t nr_chunks;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	size_t next_chunk;	/* The next chunk to decode */
+	size_t written;		/* The number of chunks written out */
+	size_t window;		/* Maximum chunks in flight */
+};
+
+
+/* Append the decoded lines of a batch to the chunk output. */
+static int emit_batch(struct decode_ctx *ctx,
+		      struct decode_chunk *chunk,
+		      const struct es51984_sample *samples,
+		      const int *errors,
+		      const int64_t *stamps,
+		      unsigned int count)
+{
+	unsigned int i;
+	size_t need;
+	char *out;
+	int len;
+
+	for (i = 0; i < count; i++) {
+		if (errors[i]) {
+			chunk->nr_invalid++;
+			continue;
+		}
+		need = chunk->out_len + LINE_MAX_LEN;
+		if (need > chunk->out_size) {
+			need = need * 2;
+			out = realloc(chunk->out, need);
+			if (!out)
+				return -ENOMEM;
+			chunk->out = out;
+			chunk->out_size = need;
+		}
+		if (ctx->binary) {
+			output_binary_record((void *)(chunk->out + chunk->out_len),
+					     &samples[i], stamps ? stamps[i] : 0, 0);
+			chunk->out_len += sizeof(struct mmmeas_bin_record);
+			chunk->nr_frames++;
+			continue;
+		}
+		len = output_format_sample(chunk->out + chunk->out_len,
+					   LINE_MAX_LEN, &samples[i],
+					   stamps ? stamps[i] : 0,
+					   ctx->csv,
+					   stamps ? ctx->timestamp : OUTPUT_TS_NONE,
+					   NULL);
+		if (len > 0 && (unsigned int)len < LINE_MAX_LEN)
+			chunk->out_len += (size_t)len;
+		chunk->nr_frames++;
+	}
+
+	return 0;
+}
+
+/* Decode a chunk of capture records. */
+static int decode_capture_chunk(struct decode_ctx *ctx,
+				struct decode_chunk *chunk)
+{
+	const struct es51984_capture_record *recs = (const void *)ctx->data;
+	struct es51984_raw_sample raw[BATCH_FRAMES];
+	struct es51984_sample samples[BATCH_FRAMES];
+	int errors[BATCH_FRAMES];
+	int64_t stamps[BATCH_FRAMES];
+	size_t i;
+	unsigned int j, count;
+	int err;
+
+	for (i = chunk->start; i < chunk->end; i += count) {
+		count = BATCH_FRAMES;
+		if (chunk->end - i < count)
+			count = (unsigned int)(chunk->end - i);
+		/* Gather the frames, so they are contiguous. */
+		for (j = 0; j < count; j++) {
+			raw[j] = recs[i + j].raw;
+			stamps[j] = (int64_t)le64toh(recs[i + j].timestamp);
+		}
+		es51984_decode_frames(ctx->board, raw, count, samples, errors);
+		err = emit_batch(ctx, chunk, samples, errors, stamps, count);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/* Find the next position at or after pos, where a valid frame starts.
+ * Returns ctx->size, if there is none. */
+static size_t find_frame(struct decode_ctx *ctx, size_t pos)
+{
+	const uint8_t *lf;
+	int32_t count;
+
+	while (pos + sizeof(struct es51984_raw_sample) <= ctx->size) {
+		/* The frame ends in CR/LF. Jump to the next LF. */
+		lf = memchr(ctx->data + pos + sizeof(struct es51984_raw_sample) - 1,
+			    '\n', ctx->size - pos - (sizeof(struct es51984_raw_sample) - 1));
+		if (!lf)
+			break;
+		pos = (size_t)(lf - ctx->data) + 1 - sizeof(struct es51984_raw_sample);
+		if (es51984_check_frames((const void *)(ctx->data + pos), 1, &count) == 1)
+			return pos;
+		pos++;
+	}
+
+	return ctx->size;
+}
+
+/* Decode a chunk of a raw data stream.
+ * The chunk owns all frames that start inside of it.
+ * The edges are resolved by scanning for the frame termination. */
+static int decode_raw_chunk(struct decode_ctx *ctx,
+			    struct decode_chunk *chunk)
+{
+	struct es51984_sample samples[BATCH_FRAMES];
+	int errors[BATCH_FRAMES];
+	size_t pos, left, next, skipped;
+	unsigned int count, good;
+	int err;
+
+	pos = find_frame(ctx, chunk->start);
+	while (pos < chunk->end) {
+		left = (ctx->size - pos) / sizeof(struct es51984_raw_sample);
+		count = BATCH_FRAMES;
+		if (left < count)
+			count = (unsigned int)left;
+		/* Don't decode frames that start in the next chunk. */
+		if ((chunk->end - pos + sizeof(struct es51984_raw_sample) - 1) /
+		    sizeof(struct es51984_raw_sample) < count)
+			count = (unsigned int)((chunk->end - pos + sizeof(struct es51984_raw_sample) - 1) /
+					       sizeof(struct es51984_raw_sample));
+		if (!count)
+			break;
+
+		es51984_decode_frames(ctx->board, (const void *)(ctx->data + pos),
+				      count, samples, errors);
+		/* Take the frames up to the first bad one. */
+		for (good = 0; good < count; good++) {
+			if (errors[good])
+				break;
+		}
+		err = emit_batch(ctx, chunk, samples, errors, NULL, good);
+		if (err)
+			return err;
+		pos += good * sizeof(struct es51984_raw_sample);
+		if (good < count) {
+			/* Lost sync. Skip to the next frame and count the
+			 * skipped bytes of this chunk as frames, rounded up. */
+			next = find_frame(ctx, pos + 1);
+			skipped = (next < chunk->end ? next : chunk->end) - pos;
+			chunk->nr_invalid += (skipped + sizeof(struct es51984_raw_sample) - 1) /
+					     sizeof(struct es51984_raw_sample);
+			pos = next;
+		}
+	}
+
+	return 0;
+}
+
+static void * decode_worker(void *arg)
+{
+	struct decode_ctx *ctx = arg;
+	struct decode_chunk *chunk;
+	size_t idx;
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		while (ctx->next_chunk < ctx->nr_chunks &&
+		       ctx->next_chunk >= ctx->written + ctx->window)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		if (ctx->next_chunk >= ctx->nr_chunks) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		idx = ctx->next_chunk++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		chunk = &ctx->chunks[idx];
+		if (ctx->capture)
+			chunk->err = decode_capture_chunk(ctx, chunk);
+		else
+			chunk->err = decode_raw_chunk(ctx, chunk);
+
+		pthread_mutex_lock(&ctx->lock);
+		chunk->done = true;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	return NULL;
+}
+
+int decode_file(const char *path,
+		enum es51984_board_type board,
+		unsigned int jobs,
+		bool csv,
+		bool binary,
+		enum output_timestamp timestamp)
+{
+	struct decode_ctx ctx;
+	const struct es51984_capture_header *hdr;
+	struct mmmeas_bin_header bin_hdr;
+	pthread_t *threads = NULL;
+	unsigned int i, nr_threads = 0;
+	unsigned long nr_frames = 0, nr_invalid = 0;
+	size_t c, unit, per_chunk;
+	struct stat st;
+	void *map = MAP_FAILED;
+	int fd, ret = -EIO;
+
+	memset(&ctx, 0, sizeof(ctx));
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Failed to open %s: %s\n",
+			path, strerror(errno));
+		goto out;
+	}
+	if (fstat(fd, &st)) {
+		fprintf(stderr, "ERROR: Failed to stat %s: %s\n",
+			path, strerror(errno));
+		goto out;
+	}
+	if (st.st_size > 0) {
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			fprintf(stderr, "ERROR: Failed to map %s: %s\n",
+				path, strerror(errno));
+			goto out;
+		}
+		madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	}
+
+	ctx.data = map == MAP_FAILED ? NULL : map;
+	ctx.size = (size_t)st.st_size;
+	ctx.board = board;
+	ctx.csv = csv;
+	ctx.binary = binary;
+	ctx.timestamp = timestamp;
+	hdr = (const void *)ctx.data;
+	if (ctx.size >= sizeof(*hdr) &&
+	    memcmp(hdr->magic, ES51984_CAPTURE_MAGIC, sizeof(hdr->magic)) == 0) {
+		if (le32toh(hdr->version) != ES51984_CAPTURE_VERSION) {
+			fprintf(stderr, "ERROR: Unsupported capture version %u\n",
+				(unsigned int)le32toh(hdr->version));
+			goto out;
+		}
+		ctx.capture = true;
+		ctx.board = (enum es51984_board_type)le32toh(hdr->board);
+		ctx.data += sizeof(*hdr);
+		ctx.size -= sizeof(*hdr);
+	}
+
+	/* Split the data into chunks. Capture chunks are counted in
+	 * records. Raw chunks are counted in bytes. */
+	unit = ctx.capture ? ctx.size / sizeof(struct es51984_capture_record)
+			   : ctx.size;
+	per_chunk = ctx.capture ? CHUNK_BYTES / sizeof(struct es51984_capture_record)
+				: CHUNK_BYTES;
+	ctx.nr_chunks = (unit + per_chunk - 1) / per_chunk;
+	ctx.chunks = calloc(ctx.nr_chunks ? ctx.nr_chunks : 1, sizeof(*ctx.chunks));
+	if (!ctx.chunks) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+	for (c = 0; c < ctx.nr_chunks; c++) {
+		ctx.chunks[c].start = c * per_chunk;
+		ctx.chunks[c].end = (c + 1) * per_chunk;
+		if (ctx.chunks[c].end > unit)
+			ctx.chunks[c].end = unit;
+	}
+
+	if (!jobs) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = cpus > 0 ? (unsigned int)cpus : 1;
+	}
+	ctx.window = (size_t)jobs * 2;
+
+	threads = calloc(jobs, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, decode_worker, &ctx)) {
+			fprintf(stderr, "ERROR: Failed to create thread\n");
+			break;
+		}
+		nr_threads++;
+	}
+
+	/* Write the chunks in order, as soon as they are done. */
+	ret = 0;
+	if (binary) {
+		output_binary_header(&bin_hdr);
+		if (fwrite(&bin_hdr, sizeof(bin_hdr), 1, stdout) != 1) {
+			fprintf(stderr, "ERROR: Failed to write output\n");
+			ret = -EIO;
+		}
+	}
+	for (c = 0; c < ctx.nr_chunks && nr_threads; c++) {
+		pthread_mutex_lock(&ctx.lock);
+		while (!ctx.chunks[c].done)
+			pthread_cond_wait(&ctx.cond, &ctx.lock);
+		pthread_mutex_unlock(&ctx.lock);
+
+		if (ctx.chunks[c].err && !ret) {
+			fprintf(stderr, "ERROR: Failed to decode: %s\n",
+				strerror(-ctx.chunks[c].err));
+			ret = ctx.chunks[c].err;
+		}
+		if (ctx.chunks[c].out_len &&
+		    fwrite(ctx.chunks[c].out, ctx.chunks[c].out_len, 1, stdout) != 1 &&
+		    !ret) {
+			fprintf(stderr, "ERROR: Failed to write output\n");
+			ret = -EIO;
+		}
+		nr_frames += ctx.chunks[c].nr_frames;
+		nr_invalid += ctx.chunks[c].nr_invalid;
+		free(ctx.chunks[c].out);
+		ctx.chunks[c].out = NULL;
+
+		pthread_mutex_lock(&ctx.lock);
+		ctx.written++;
+		pthread_cond_broadcast(&ctx.cond);
+		pthread_mutex_unlock(&ctx.lock);
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	if (!nr_threads && ctx.nr_chunks)
+		ret = -EIO;
+	fflush(stdout);
+
+	fprintf(stderr, "Decoded %lu frames, %lu invalid.\n",
+		nr_frames, nr_invalid);
+out:
+	free(threads);
+	free(ctx.chunks);
+	if (map != MAP_FAILED)
+		munmap(map, (size_t)st.st_size);
+	if (fd >= 0)
+		close(fd);
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+
+	return ret;
+}
@@ -0,0 +1,37 @@
+#ifndef DECODE_H_
+#define DECODE_H_
+
+/* Parallel offline decoding of capture files and raw stream dumps. */
+
+#include "es51984.h"
+#include "output.h"
+
+#include <stdbool.h>
+
+
+/** decode_file - Decode a capture file or raw data stream dump.
+ *
+ * The file is memory mapped and split into chunks, which are decoded
+ * by a pool of worker threads. The decoded lines are written to
+ * stdout in file order.
+ * A file that doesn't start with a capture header is treated as
+ * a raw dump of the serial data stream. It carries no time stamps.
+ *
+ * Returns zero on success, or a negative error code on failure.
+ *
+ * @path: The file to decode.
+ * @board: The board type for raw stream dumps.
+ * @jobs: The number of worker threads. 0 selects the number of CPUs.
+ * @csv: If true, use CSV output.
+ * @binary: If true, write a --binary record stream.
+ * @timestamp: The time stamp format.
+ */
+int decode_file(const char *path,
+		enum es51984_board_type board,
+		unsigned int jobs,
+		bool csv,
+		bool binary,
+		enum output_timestamp timestamp);
+
+
+#endif /* DECODE_H_ */
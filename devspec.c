@@ -0,0 +1,49 @@
+/*
+ *   Multimeter measurement
+ *   DEVICE[:BOARD] argument parsing
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "devspec.h"
+
+#include <string.h>
+
+
+static const struct {
+	const char *name;
+	enum es51984_board_type board;
+} board_names[] = {
+	{ "35xpa", ES51984_BOARD_AMPROBE_35XPA, },
+	{ "unknown", ES51984_BOARD_UNKNOWN, },
+};
+
+void parse_device_spec(char *spec, enum es51984_board_type *board)
+{
+	char *colon;
+	unsigned int i;
+
+	*board = ES51984_BOARD_AMPROBE_35XPA;
+	/* Device paths may contain colons, e.g. in /dev/serial/by-path.
+	 * Only a known board name after the last one is split off. */
+	colon = strrchr(spec, ':');
+	if (!colon)
+		return;
+	for (i = 0; i < sizeof(board_names) / sizeof(board_names[0]); i++) {
+		if (strcmp(colon + 1, board_names[i].name) == 0) {
+			*colon = '\0';
+			*board = board_names[i].board;
+			return;
+		}
+	}
+}
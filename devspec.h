@@ -0,0 +1,21 @@
+#ifndef DEVSPEC_H_
+#define DEVSPEC_H_
+
+/* DEVICE[:BOARD] argument parsing. */
+
+#include "es51984.h"
+
+
+/** parse_device_spec - Split a DEVICE[:BOARD] argument.
+ *
+ * If the text after the last ':' is a known board name, the spec is
+ * cut at that ':' and the board is returned. Otherwise the whole spec
+ * is the device path and the board is the default, the 35XP-A.
+ *
+ * @spec: The argument. It is modified in place.
+ * @board: Returns the board type.
+ */
+void parse_device_spec(char *spec, enum es51984_board_type *board);
+
+
+#endif /* DEVSPEC_H_ */
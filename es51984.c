@@ -24,24 +24,85 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <endian.h>
 #include <termios.h>
+#include <poll.h>
 #include <time.h>
-#include <sys/time.h>
 #include <math.h>
 #include <float.h>
 #include <assert.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define ES51984_X86_SIMD	1
+#endif
+
 
 #define PFX	"es51984: "
 
+/* Size of the receive buffer. This holds a few hundred frames. */
+#define ES51984_RXBUF_SIZE	4096
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+
+/* Number of read() arrival times tracked in the receive buffer. */
+#define ES51984_RX_MARKS	16
+
+/* The receive buffer up to 'end' arrived at this time (nanoseconds). */
+struct rx_mark {
+	unsigned int end;
+	int64_t mono;
+	int64_t real;
+};
+
 
 struct es51984 {
 	enum es51984_board_type board;
 	const char *tty;
 	int fd;
 	int synced;
-	unsigned char sample_buf[11];
-	unsigned int sample_ptr;
+	/* A bad frame was dropped. rx_start must be moved to the
+	 * next frame boundary before the next frame is taken. */
+	int reframe;
+
+	/* The currently active tty attributes. */
+	struct termios ios;
+
+	/* Number of syscalls on the tty. Total and at the last sample. */
+	unsigned long syscalls;
+	unsigned long syscalls_last;
+
+	/* Statistics. The syscalls are counted above. */
+	struct es51984_stats stats;
+
+	/* Receive buffer. The bytes from rx_start up to rx_end
+	 * have been read from the tty, but not consumed, yet.
+	 * If synchronized, rx_start points to the start of a frame. */
+	unsigned char rxbuf[ES51984_RXBUF_SIZE];
+	unsigned int rx_start;
+	unsigned int rx_end;
+	/* The last read() emptied the tty input queue. */
+	int rx_drained;
+	/* Arrival times of the buffered data. One mark per read(). */
+	struct rx_mark rx_marks[ES51984_RX_MARKS];
+	unsigned int nr_rx_marks;
+	/* Arrival time of the frame taken last. */
+	struct rx_mark frame_mark;
+	/* Arrival time of the first byte of the frame taken last. */
+	int64_t frame_first_mono;
+	/* Number of valid frames at rx_start handed out by
+	 * es51984_peek_frames() and not released, yet. */
+	unsigned int nr_peeked;
+
+	/* Capture file for recording, or NULL. */
+	FILE *capture;
+
+	/* Capture file for replay, or NULL. */
+	FILE *replay;
+	int replay_realtime;
+	int replay_started;
+	int64_t replay_mono_base;
+	int64_t replay_stamp_base;
 };
 
 enum es51984_voltage_range {
@@ -94,31 +155,6 @@ enum es51984_cap_range {
 	ES51984_CAPRANGE_4p000m		= ES51984_PACK(6), /* 4.000 mF */
 };
 
-struct es51984_raw_sample {
-	uint8_t range;
-	uint8_t digit3;
-	uint8_t digit2;
-	uint8_t digit1;
-	uint8_t digit0;
-	uint8_t function;
-	uint8_t status;
-	uint8_t option1;
-	uint8_t option2;
-	uint8_t cr;
-	uint8_t lf;
-} __attribute__((__packed__));
-
-#define ES51984_DIGIT_MASK	0x0F
-#define ES51984_STATUS_JUDGE	0x08
-#define ES51984_STATUS_SIGN	0x04
-#define ES51984_STATUS_BATT	0x02
-#define ES51984_STATUS_OL	0x01
-#define ES51984_OPT1_HOLD	0x08
-#define ES51984_OPT2_DC		0x08
-#define ES51984_OPT2_AC		0x04
-#define ES51984_OPT2_AUTO	0x02
-
-
 static void dump_raw_sample(const char *description,
 			    struct es51984_raw_sample *raw)
 {
@@ -134,68 +170,396 @@ static void dump_raw_sample(const char *description,
 	       raw->digit3, raw->digit2, raw->digit1, raw->digit0);
 }
 
+/* Set the number of characters a read() blocks for.
+ * The tty attributes are cached, so this only costs a syscall,
+ * if the blocking mode actually changes. */
 static int set_blocking(struct es51984 *es, unsigned int block_chars)
 {
 	struct termios ios;
 	int err;
 
-	err = tcgetattr(es->fd, &ios);
-	if (err < 0) {
-		fprintf(stderr, PFX "Failed to get tty attributes on %s: %s\n",
-			es->tty, strerror(errno));
-		return -EIO;
-	}
+	if (es->replay)
+		return 0;
+	if (es->ios.c_cc[VMIN] == block_chars)
+		return 0;
+
+	ios = es->ios;
 	ios.c_cc[VMIN] = block_chars;
+	es->syscalls++;
 	err = tcsetattr(es->fd, TCSANOW, &ios);
 	if (err < 0) {
 		fprintf(stderr, PFX "Failed to set tty attributes on %s: %s\n",
 			es->tty, strerror(errno));
 		return -EIO;
 	}
+	es->ios = ios;
 
 	return 0;
 }
 
-static int read_sample(struct es51984 *es,
-		       struct es51984_raw_sample **sample,
-		       int blocking)
+/* Get the monotonic time in milliseconds. */
+static int64_t clock_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Get the time of a clock in nanoseconds. */
+static int64_t clock_nsec(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Sleep until input is available on the tty.
+ * A negative timeout_ms blocks forever. Otherwise the wait is
+ * limited to the absolute monotonic deadline in milliseconds.
+ * Returns 0, if input is available or if the wait was interrupted.
+ * Returns -EAGAIN on timeout. */
+static int wait_input(struct es51984 *es, int timeout_ms, int64_t deadline)
+{
+	struct pollfd pfd;
+	int64_t remaining;
+	int res;
+
+	if (timeout_ms == 0)
+		return -EAGAIN;
+	if (timeout_ms > 0) {
+		remaining = deadline - clock_msec();
+		if (remaining <= 0)
+			return -EAGAIN;
+		timeout_ms = (int)remaining;
+	}
+
+	pfd.fd = es->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	es->syscalls++;
+	res = poll(&pfd, 1, timeout_ms);
+	if (res < 0) {
+		if (errno == EINTR)
+			return 0;
+		fprintf(stderr, PFX "Failed to poll %s: %s\n",
+			es->tty, strerror(errno));
+		return -EIO;
+	}
+	if (res == 0)
+		return -EAGAIN;
+	if (!(pfd.revents & POLLIN) &&
+	    (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+		fprintf(stderr, PFX "Poll error on %s\n", es->tty);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/* Returns the number of received, but not consumed bytes. */
+static unsigned int rx_avail(const struct es51984 *es)
+{
+	return es->rx_end - es->rx_start;
+}
+
+/* Remember that the data up to rx_end arrived at the given time. */
+static void rx_mark(struct es51984 *es, int64_t mono, int64_t real)
+{
+	struct rx_mark *mark;
+
+	if (es->nr_rx_marks >= ARRAY_SIZE(es->rx_marks)) {
+		/* Many tiny reads without a complete frame.
+		 * Merge with the newest mark. */
+		es->nr_rx_marks--;
+	}
+	mark = &es->rx_marks[es->nr_rx_marks++];
+	mark->end = es->rx_end;
+	mark->mono = mono;
+	mark->real = real;
+}
+
+/* Drop the marks of data before rx_start and rebase the rest
+ * after the receive buffer was compacted by 'shift' bytes. */
+static void rx_marks_rebase(struct es51984 *es, unsigned int shift)
+{
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < es->nr_rx_marks; i++) {
+		if (es->rx_marks[i].end <= shift)
+			continue;
+		es->rx_marks[j] = es->rx_marks[i];
+		es->rx_marks[j].end -= shift;
+		j++;
+	}
+	es->nr_rx_marks = j;
+}
+
+/* Read the next frame from the replay capture into the receive buffer.
+ * In real-time mode this sleeps until the frame is due.
+ * Returns the number of bytes read or a negative error code.
+ * Returns -ENODATA at the end of the capture. */
+static int replay_fill(struct es51984 *es)
 {
+	struct es51984_capture_record rec;
 	struct timespec ts;
+	int64_t stamp, due;
+
+	if (sizeof(es->rxbuf) - es->rx_end < sizeof(rec.raw))
+		return 0;
+
+	if (fread(&rec, sizeof(rec), 1, es->replay) != 1) {
+		if (ferror(es->replay)) {
+			fprintf(stderr, PFX "Failed to read capture %s\n",
+				es->tty);
+			return -EIO;
+		}
+		return -ENODATA;
+	}
+	stamp = (int64_t)le64toh(rec.timestamp);
+
+	if (es->replay_realtime) {
+		if (!es->replay_started) {
+			es->replay_started = 1;
+			es->replay_mono_base = clock_nsec(CLOCK_MONOTONIC);
+			es->replay_stamp_base = stamp;
+		}
+		due = es->replay_mono_base + (stamp - es->replay_stamp_base);
+		ts.tv_sec = due / 1000000000;
+		ts.tv_nsec = due % 1000000000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &ts, NULL) == EINTR)
+			;
+	}
+
+	memcpy(es->rxbuf + es->rx_end, &rec.raw, sizeof(rec.raw));
+	es->rx_end += sizeof(rec.raw);
+	es->stats.bytes += sizeof(rec.raw);
+	if (!es->replay_started) {
+		es->replay_started = 1;
+		es->replay_mono_base = clock_nsec(CLOCK_MONOTONIC);
+		es->replay_stamp_base = stamp;
+	}
+	/* Replay the recorded time line. */
+	rx_mark(es, es->replay_mono_base + (stamp - es->replay_stamp_base),
+		stamp);
+
+	return sizeof(rec.raw);
+}
+
+/* Append a frame to the capture file. */
+static void capture_frame(struct es51984 *es,
+			  const struct es51984_raw_sample *raw)
+{
+	struct es51984_capture_record rec;
+
+	rec.timestamp = htole64((uint64_t)es->frame_mark.real);
+	rec.raw = *raw;
+	if (fwrite(&rec, sizeof(rec), 1, es->capture) != 1) {
+		fprintf(stderr, PFX "Failed to write capture. "
+			"Recording stopped.\n");
+		fclose(es->capture);
+		es->capture = NULL;
+	}
+}
+
+/* Write the buffered capture records to the file. */
+static void capture_flush(struct es51984 *es)
+{
+	if (es->capture)
+		fflush(es->capture);
+}
+
+/* Read as much as possible from the tty into the receive buffer
+ * with a single read() call.
+ * Returns the number of bytes read or a negative error code. */
+static int rx_fill(struct es51984 *es)
+{
+	unsigned int avail = rx_avail(es);
+	size_t count;
 	ssize_t res;
-	int err;
 
-	assert(sizeof(es->sample_buf) == sizeof(struct es51984_raw_sample));
+	if (es->rx_start) {
+		/* Move the partial frame to the start of the buffer. */
+		memmove(es->rxbuf, es->rxbuf + es->rx_start, avail);
+		rx_marks_rebase(es, es->rx_start);
+		es->rx_start = 0;
+		es->rx_end = avail;
+	}
+	if (es->replay)
+		return replay_fill(es);
+	if (es->rx_end >= sizeof(es->rxbuf))
+		return 0;
+
+	count = sizeof(es->rxbuf) - es->rx_end;
+	es->syscalls++;
+	res = read(es->fd, es->rxbuf + es->rx_end, count);
+	es->rx_drained = (res < (ssize_t)count);
+	if (res < 0) {
+		if (errno == EINTR || errno == EAGAIN)
+			return 0;
+		fprintf(stderr, PFX "Failed to read %s: %s\n",
+			es->tty, strerror(errno));
+		return -EIO;
+	}
+	es->rx_end += (unsigned int)res;
+	es->stats.bytes += (uint64_t)res;
+	if (res > 0) {
+		/* The terminating bytes of all frames that are complete
+		 * now arrived no later than this. */
+		rx_mark(es, clock_nsec(CLOCK_MONOTONIC),
+			clock_nsec(CLOCK_REALTIME));
+	}
+
+	return (int)res;
+}
 
-	err = set_blocking(es, blocking ? sizeof(struct es51984_raw_sample) : 0);
+/* Check whether a frame might start at the given position.
+ * All payload bytes carry 0x3 in the high nibble and the frame
+ * is terminated by CR/LF. A window that is not aligned to a frame
+ * never passes, because CR/LF would land on a payload byte. */
+static int frame_plausible(const unsigned char *p)
+{
+	unsigned int i;
+
+	if (p[9] != '\r' || p[10] != '\n')
+		return 0;
+	for (i = 0; i < 9; i++) {
+		if ((p[i] & 0xF0) != 0x30)
+			return 0;
+	}
+	return 1;
+}
+
+/* Scan the buffered bytes for the next frame boundary.
+ * Bytes that can't start a frame are dropped.
+ * Returns 1, if rx_start now points to a plausible frame.
+ * Returns 0, if more data is needed. */
+static int rx_resync(struct es51984 *es)
+{
+	while (rx_avail(es) >= sizeof(struct es51984_raw_sample)) {
+		if (frame_plausible(es->rxbuf + es->rx_start))
+			return 1;
+		es->rx_start++;
+		es->stats.dropped_bytes++;
+	}
+	return 0;
+}
+
+/* Check whether a complete frame is buffered at rx_start.
+ * After a bad frame this first re-frames to the next frame boundary
+ * in the buffered data. */
+static int rx_frame_ready(struct es51984 *es)
+{
+	if (es->reframe) {
+		if (!rx_resync(es))
+			return 0;
+		es->reframe = 0;
+		es->stats.resyncs++;
+	}
+	return rx_avail(es) >= sizeof(struct es51984_raw_sample);
+}
+
+/* Wait until at least one complete frame is buffered.
+ * The tty is only read, if no complete frame is buffered.
+ *
+ * An infinite timeout blocks in read() (VMIN=1). That is one syscall
+ * per wakeup. Finite timeouts use non-blocking reads (VMIN=0) and
+ * sleep in poll(). */
+static int rx_wait_frame(struct es51984 *es, int timeout_ms)
+{
+	int64_t deadline = 0;
+	int err, res;
+
+	if (rx_frame_ready(es))
+		return 0;
+
+	/* We are about to sleep. Write out the recorded frames. */
+	capture_flush(es);
+
+	err = set_blocking(es, timeout_ms < 0 ? 1 : 0);
 	if (err)
 		return err;
-	while (1) {
-		res = read(es->fd, es->sample_buf + es->sample_ptr,
-			   sizeof(struct es51984_raw_sample) - es->sample_ptr);
+	if (timeout_ms > 0)
+		deadline = clock_msec() + timeout_ms;
+	while (!rx_frame_ready(es)) {
+		if (timeout_ms > 0 && es->rx_drained) {
+			/* The tty queue was empty at the last read.
+			 * Don't waste a read() syscall. Wait right away. */
+			err = wait_input(es, timeout_ms, deadline);
+			if (err)
+				goto error;
+		}
+		res = rx_fill(es);
 		if (res < 0)
-			return -EIO;
+			return res;
 		if (res == 0) {
-			if (!blocking)
-				return -EAGAIN;
-			ts.tv_sec = 0;
-			ts.tv_nsec = 1000*1000;
-			nanosleep(&ts, &ts);
-			continue;
+			/* No data. Sleep until the next byte arrives. */
+			err = wait_input(es, timeout_ms, deadline);
+			if (err)
+				goto error;
 		}
-		es->sample_ptr += res;
-		if (es->sample_ptr >= sizeof(struct es51984_raw_sample)) {
-			*sample = (void *)es->sample_buf;
-			es->sample_ptr = 0;
+	}
+
+	return 0;
+
+error:
+	if (err == -EAGAIN)
+		es->stats.eagain++;
+	return err;
+}
+
+/* Consume the frame at the start of the receive buffer.
+ * Its arrival time is stored in frame_mark and the arrival time
+ * of its first byte in frame_first_mono.
+ * The returned pointer is valid until the next call to rx_fill(). */
+static struct es51984_raw_sample * rx_take_frame(struct es51984 *es)
+{
+	struct es51984_raw_sample *raw;
+	unsigned int i;
+
+	raw = (void *)(es->rxbuf + es->rx_start);
+	/* The peeked frames are no longer at rx_start. */
+	es->nr_peeked = 0;
+
+	/* Find the read()s that delivered the first and the last byte
+	 * of the frame. */
+	for (i = 0; i + 1 < es->nr_rx_marks; i++) {
+		if (es->rx_marks[i].end > es->rx_start)
+			break;
+	}
+	if (i < es->nr_rx_marks)
+		es->frame_first_mono = es->rx_marks[i].mono;
+	es->rx_start += sizeof(struct es51984_raw_sample);
+	for (; i + 1 < es->nr_rx_marks; i++) {
+		if (es->rx_marks[i].end >= es->rx_start)
 			break;
-		}
-		if (!blocking)
-			return -EAGAIN;
 	}
+	if (i < es->nr_rx_marks)
+		es->frame_mark = es->rx_marks[i];
+
+	return raw;
+}
+
+/* Get the next frame from the receive buffer. */
+static int read_sample(struct es51984 *es,
+		       struct es51984_raw_sample **sample,
+		       int timeout_ms)
+{
+	int err;
+
+	err = rx_wait_frame(es, timeout_ms);
+	if (err)
+		return err;
+	*sample = rx_take_frame(es);
 
 	return 0;
 }
 
-static int digits_sanity_check(struct es51984_raw_sample *raw)
+static int digits_sanity_check(const struct es51984_raw_sample *raw)
 {
 	if ((raw->digit3 & 0xF0) != 0x30 ||
 	    (raw->digit2 & 0xF0) != 0x30 ||
@@ -210,256 +574,176 @@ static int digits_sanity_check(struct es51984_raw_sample *raw)
 	return 0; /* Digits are OK */
 }
 
-static void parse_4p000(struct es51984_raw_sample *raw,
-			struct es51984_sample *sample)
-{
-	sample->value += (double)(raw->digit3 & ES51984_DIGIT_MASK);
-	sample->value += (double)(raw->digit2 & ES51984_DIGIT_MASK) / 10.0l;
-	sample->value += (double)(raw->digit1 & ES51984_DIGIT_MASK) / 100.0l;
-	sample->value += (double)(raw->digit0 & ES51984_DIGIT_MASK) / 1000.0l;
-}
+/** struct es51984_func_desc - Decoder table entry of a device function.
+ * @flags: DECODE_... flags.
+ * @nr_ranges: The number of valid range codes.
+ * @exponent: Decimal exponent of the digit count for each range code.
+ */
+struct es51984_func_desc {
+	uint8_t flags;
+	uint8_t nr_ranges;
+	int8_t exponent[7];
+};
 
-static void parse_40p00(struct es51984_raw_sample *raw,
-			struct es51984_sample *sample)
-{
-	sample->value += (double)(raw->digit3 & ES51984_DIGIT_MASK) * 10.0l;
-	sample->value += (double)(raw->digit2 & ES51984_DIGIT_MASK);
-	sample->value += (double)(raw->digit1 & ES51984_DIGIT_MASK) / 10.0l;
-	sample->value += (double)(raw->digit0 & ES51984_DIGIT_MASK) / 100.0l;
-}
+#define DECODE_VALID		0x01 /* The function code is valid */
+#define DECODE_NORANGE		0x02 /* The range code is ignored */
+#define DECODE_NOVALUE		0x04 /* The value is not decoded */
+#define DECODE_OL		0x08 /* Always overflow (unsupported) */
 
-static void parse_400p0(struct es51984_raw_sample *raw,
-			struct es51984_sample *sample)
-{
-	sample->value += (double)(raw->digit3 & ES51984_DIGIT_MASK) * 100.0l;
-	sample->value += (double)(raw->digit2 & ES51984_DIGIT_MASK) * 10.0l;
-	sample->value += (double)(raw->digit1 & ES51984_DIGIT_MASK);
-	sample->value += (double)(raw->digit0 & ES51984_DIGIT_MASK) / 10.0l;
-}
+#define FUNC_IDX(func)		((func) & 0x0F)
+
+/* Functions that decode the same on all boards. */
+#define DECODE_COMMON_FUNCS							\
+	[FUNC_IDX(ES51984_FUNC_VOLTAGE)] = {					\
+		/* 4.000 V, 40.00 V, 400.0 V, 4000 V, 400.0 mV */		\
+		DECODE_VALID, 5, { -3, -2, -1, 0, -4, },			\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_UA_CURRENT)] = {					\
+		/* 400.0 uA, 4000 uA */						\
+		DECODE_VALID, 2, { -1, 0, },					\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_MA_CURRENT)] = {					\
+		/* 40.00 mA, 400.0 mA */					\
+		DECODE_VALID, 2, { -2, -1, },					\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_AUTO_CURRENT)] = {				\
+		/* 4.000 A, 40.00 A */						\
+		DECODE_VALID, 2, { -3, -2, },					\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_MAN_CURRENT)] = {				\
+		/* TODO: What range do we have here? */				\
+		DECODE_VALID | DECODE_NORANGE | DECODE_NOVALUE, 0, { 0, },	\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_OHMS)] = {					\
+		/* 400.0 Ohms, 4.000 k, 40.00 k, 400.0 k, 4.000 M, 40.00 M */	\
+		DECODE_VALID, 6, { -1, 0, 1, 2, 3, 4, },			\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_CONT)] = {					\
+		DECODE_VALID | DECODE_NORANGE, 0, { 0, },			\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_DIODE)] = {					\
+		DECODE_VALID | DECODE_NORANGE, 0, { -3, },			\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_FREQUENCY)] = {					\
+		/* 4.000 kHz, 40.00 k, 400.0 k, 4.000 M, 40.00 M */		\
+		DECODE_VALID, 5, { 0, 1, 2, 3, 4, },				\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_CAPACITOR)] = {					\
+		/* 4.000 nF, 40.00 n, 400.0 n, 4.000 u, 40.00 u, 400.0 u,	\
+		 * 4.000 mF */							\
+		DECODE_VALID, 7, { -12, -11, -10, -9, -8, -7, -6, },		\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_TEMP)] = {					\
+		/* TODO: What range do we have here? */				\
+		DECODE_VALID | DECODE_NORANGE | DECODE_NOVALUE, 0, { 0, },	\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_ADP2)] = {					\
+		DECODE_VALID | DECODE_NORANGE | DECODE_OL, 0, { 0, },		\
+	},									\
+	[FUNC_IDX(ES51984_FUNC_ADP3)] = {					\
+		DECODE_VALID | DECODE_NORANGE | DECODE_OL, 0, { 0, },		\
+	},
+
+/* The decoder table, indexed by board and function code.
+ * Unlisted function codes are invalid. */
+static const struct es51984_func_desc decode_table[][16] = {
+	[ES51984_BOARD_UNKNOWN] = {
+		DECODE_COMMON_FUNCS
+		[FUNC_IDX(ES51984_FUNC_ADP0)] = {
+			DECODE_VALID | DECODE_NORANGE | DECODE_OL, 0, { 0, },
+		},
+		[FUNC_IDX(ES51984_FUNC_ADP1)] = {
+			DECODE_VALID | DECODE_NORANGE | DECODE_OL, 0, { 0, },
+		},
+	},
+	[ES51984_BOARD_AMPROBE_35XPA] = {
+		DECODE_COMMON_FUNCS
+		[FUNC_IDX(ES51984_FUNC_ADP0)] = {
+			/* 4000 C/F */
+			DECODE_VALID | DECODE_NORANGE, 0, { 0, },
+		},
+		[FUNC_IDX(ES51984_FUNC_ADP1)] = {
+			/* 400.0 C/F */
+			DECODE_VALID | DECODE_NORANGE, 0, { -1, },
+		},
+	},
+};
+
+/* Powers of ten that are exactly representable as double. */
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+	1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+};
 
-static void parse_4000(struct es51984_raw_sample *raw,
-		       struct es51984_sample *sample)
+/* Reasons for a frame to be invalid. */
+enum decode_error {
+	DECODE_OK,
+	DECODE_ERR_DIGITS,
+	DECODE_ERR_FUNCTION,
+	DECODE_ERR_RANGE,
+	DECODE_ERR_STATUS,
+	DECODE_ERR_OPTION1,
+	DECODE_ERR_OPTION2,
+	DECODE_ERR_TERMINATION,
+};
+
+/* Get the unsigned digit count of a frame with sane digits. */
+static int32_t digits_count(const struct es51984_raw_sample *raw)
 {
-	sample->value += (double)(raw->digit3 & ES51984_DIGIT_MASK) * 1000.0l;
-	sample->value += (double)(raw->digit2 & ES51984_DIGIT_MASK) * 100.0l;
-	sample->value += (double)(raw->digit1 & ES51984_DIGIT_MASK) * 10.0l;
-	sample->value += (double)(raw->digit0 & ES51984_DIGIT_MASK);
+	return (int32_t)(raw->digit3 & ES51984_DIGIT_MASK) * 1000 +
+	       (int32_t)(raw->digit2 & ES51984_DIGIT_MASK) * 100 +
+	       (int32_t)(raw->digit1 & ES51984_DIGIT_MASK) * 10 +
+	       (int32_t)(raw->digit0 & ES51984_DIGIT_MASK);
 }
 
-static int parse_sample(struct es51984 *es,
-			struct es51984_raw_sample *raw,
-			struct es51984_sample *sample)
+/* Decode a frame, whose digits have already been checked.
+ * count is the unsigned digit count of the frame.
+ * Returns DECODE_OK or the reason why the frame is invalid. */
+static enum decode_error decode_frame(unsigned int board,
+				      const struct es51984_raw_sample *raw,
+				      int32_t count,
+				      struct es51984_sample *sample)
 {
-	if (digits_sanity_check(raw)) {
-		fprintf(stderr, PFX "Got invalid digits %02X %02X %02X %02X (func %02X)\n",
-			raw->digit3, raw->digit2, raw->digit1, raw->digit0,
-			raw->function);
-		goto error;
+	const struct es51984_func_desc *desc;
+	unsigned int range;
+	int exponent;
+
+	if (board >= ARRAY_SIZE(decode_table))
+		board = ES51984_BOARD_UNKNOWN;
+	desc = &decode_table[board][FUNC_IDX(raw->function)];
+	if ((raw->function & 0xF0) != 0x30 || !(desc->flags & DECODE_VALID))
+		return DECODE_ERR_FUNCTION;
+	if (desc->flags & DECODE_NORANGE) {
+		range = 0;
+		exponent = desc->exponent[0];
+	} else {
+		range = raw->range ^ 0x30;
+		if (range >= desc->nr_ranges)
+			return DECODE_ERR_RANGE;
+		exponent = desc->exponent[range];
 	}
+	sample->range = (int)range;
 
-	switch (raw->function) {
-	case ES51984_FUNC_VOLTAGE:
-		switch (raw->range) {
-		case ES51984_VOLTRANGE_4p000:
-			parse_4p000(raw, sample);
-			break;
-		case ES51984_VOLTRANGE_40p00:
-			parse_40p00(raw, sample);
-			break;
-		case ES51984_VOLTRANGE_400p0:
-			parse_400p0(raw, sample);
-			break;
-		case ES51984_VOLTRANGE_4000:
-			parse_4000(raw, sample);
-			break;
-		case ES51984_VOLTRANGE_400p0m:
-			parse_400p0(raw, sample);
-			sample->value /= 1000.0l;
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_UA_CURRENT:
-		switch (raw->range) {
-		case ES51984_UARANGE_400p0:
-			parse_400p0(raw, sample);
-			break;
-		case ES51984_UARANGE_4000:
-			parse_4000(raw, sample);
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_MA_CURRENT:
-		switch (raw->range) {
-		case ES51984_MARANGE_40p00:
-			parse_40p00(raw, sample);
-			break;
-		case ES51984_MARANGE_400p0:
-			parse_400p0(raw, sample);
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_AUTO_CURRENT:
-		switch (raw->range) {
-		case ES51984_AARANGE_4p000:
-			parse_4p000(raw, sample);
-			break;
-		case ES51984_AARANGE_40p00:
-			parse_40p00(raw, sample);
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_MAN_CURRENT:
-		/* TODO: What range do we have here? */
-		break;
-	case ES51984_FUNC_OHMS:
-		switch (raw->range) {
-		case ES51984_OHMRANGE_400p0:
-			parse_400p0(raw, sample);
-			break;
-		case ES51984_OHMRANGE_4p000k:
-			parse_4p000(raw, sample);
-			sample->value *= 1000.0l;
-			break;
-		case ES51984_OHMRANGE_40p00k:
-			parse_40p00(raw, sample);
-			sample->value *= 1000.0l;
-			break;
-		case ES51984_OHMRANGE_400p0k:
-			parse_400p0(raw, sample);
-			sample->value *= 1000.0l;
-			break;
-		case ES51984_OHMRANGE_4p000m:
-			parse_4p000(raw, sample);
-			sample->value *= 1000000.0l;
-			break;
-		case ES51984_OHMRANGE_40p00m:
-			parse_40p00(raw, sample);
-			sample->value *= 1000000.0l;
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_CONT:
-		parse_4000(raw, sample);
-		break;
-	case ES51984_FUNC_DIODE:
-		parse_4p000(raw, sample);
-		break;
-	case ES51984_FUNC_FREQUENCY:
-		switch (raw->range) {
-		case ES51984_FREQRANGE_4p000k:
-			parse_4p000(raw, sample);
-			sample->value *= 1000.0l;
-			break;
-		case ES51984_FREQRANGE_40p00k:
-			parse_40p00(raw, sample);
-			sample->value *= 1000.0l;
-			break;
-		case ES51984_FREQRANGE_400p0k:
-			parse_400p0(raw, sample);
-			sample->value *= 1000.0l;
-			break;
-		case ES51984_FREQRANGE_4p000m:
-			parse_4p000(raw, sample);
-			sample->value *= 1000000.0l;
-			break;
-		case ES51984_FREQRANGE_40p00m:
-			parse_40p00(raw, sample);
-			sample->value *= 1000000.0l;
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_CAPACITOR:
-		switch (raw->range) {
-		case ES51984_CAPRANGE_4p000n:
-			parse_4p000(raw, sample);
-			sample->value /= 1000000000.0l;
-			break;
-		case ES51984_CAPRANGE_40p00n:
-			parse_40p00(raw, sample);
-			sample->value /= 1000000000.0l;
-			break;
-		case ES51984_CAPRANGE_400p0n:
-			parse_400p0(raw, sample);
-			sample->value /= 1000000000.0l;
-			break;
-		case ES51984_CAPRANGE_4p000u:
-			parse_4p000(raw, sample);
-			sample->value /= 1000000.0l;
-			break;
-		case ES51984_CAPRANGE_40p00u:
-			parse_40p00(raw, sample);
-			sample->value /= 1000000.0l;
-			break;
-		case ES51984_CAPRANGE_400p0u:
-			parse_400p0(raw, sample);
-			sample->value /= 1000000.0l;
-			break;
-		case ES51984_CAPRANGE_4p000m:
-			parse_4p000(raw, sample);
-			sample->value /= 1000.0l;
-			break;
-		default:
-			goto invalid_range;
-		}
-		break;
-	case ES51984_FUNC_TEMP:
-		/* TODO: What range do we have here? */
-		break;
-	case ES51984_FUNC_ADP0:
-		switch (sample->board) {
-		case ES51984_BOARD_UNKNOWN:
-			sample->overflow = 1;
-			sample->value = DBL_MAX;
-			break;
-		case ES51984_BOARD_AMPROBE_35XPA:
-			parse_4000(raw, sample);
-			break;
-		}
-		break;
-	case ES51984_FUNC_ADP1:
-		switch (sample->board) {
-		case ES51984_BOARD_UNKNOWN:
-			sample->overflow = 1;
-			sample->value = DBL_MAX;
-			break;
-		case ES51984_BOARD_AMPROBE_35XPA:
-			parse_400p0(raw, sample);
-			break;
-		}
-		break;
-	case ES51984_FUNC_ADP2:
-		sample->overflow = 1;
-		sample->value = DBL_MAX;
-		break;
-	case ES51984_FUNC_ADP3:
+	if (desc->flags & (DECODE_NOVALUE | DECODE_OL)) {
+		count = 0;
+		exponent = 0;
+	}
+	/* Exactly one correctly rounded operation. */
+	if (exponent < 0)
+		sample->value = (double)count / pow10_table[-exponent];
+	else
+		sample->value = (double)count * pow10_table[exponent];
+	sample->count = count;
+	sample->exponent = exponent;
+	if (desc->flags & DECODE_OL) {
 		sample->overflow = 1;
 		sample->value = DBL_MAX;
-		break;
-	default:
-		fprintf(stderr, PFX "Got invalid function code %02X\n",
-			raw->function);
-		goto error;
 	}
 	sample->function = raw->function;
 
 	/* Parse status code */
-	if ((raw->status & 0xF0) != 0x30) {
-		fprintf(stderr, PFX "Got invalid status code %02X (func %02X)\n",
-			raw->status, raw->function);
-		goto error;
-	}
+	if ((raw->status & 0xF0) != 0x30)
+		return DECODE_ERR_STATUS;
 	if (raw->function == ES51984_FUNC_TEMP) {
 		if (raw->status & ES51984_STATUS_JUDGE)
 			sample->degree = 1;
@@ -470,26 +754,22 @@ static int parse_sample(struct es51984 *es,
 		sample->overflow = 1;
 		sample->value = DBL_MAX;
 	}
-	if (raw->status & ES51984_STATUS_SIGN)
+	if (raw->status & ES51984_STATUS_SIGN) {
 		sample->value = -(sample->value);
+		sample->count = -(sample->count);
+	}
 	if (raw->status & ES51984_STATUS_BATT)
 		sample->batt_low = 1;
 
 	/* Parse option1 code */
-	if ((raw->option1 & 0xF0) != 0x30) {
-		fprintf(stderr, PFX "Got invalid option1 code %02X (func %02X)\n",
-			raw->option1, raw->function);
-		goto error;
-	}
+	if ((raw->option1 & 0xF0) != 0x30)
+		return DECODE_ERR_OPTION1;
 	if (raw->option1 & ES51984_OPT1_HOLD)
 		sample->hold = 1;
 
 	/* Parse option2 code */
-	if ((raw->option2 & 0xF0) != 0x30) {
-		fprintf(stderr, PFX "Got invalid option2 code %02X (func %02X)\n",
-			raw->option2, raw->function);
-		goto error;
-	}
+	if ((raw->option2 & 0xF0) != 0x30)
+		return DECODE_ERR_OPTION2;
 	if (raw->option2 & ES51984_OPT2_DC)
 		sample->dc_mode = 1;
 	if (raw->option2 & ES51984_OPT2_AC)
@@ -498,49 +778,542 @@ static int parse_sample(struct es51984 *es,
 		sample->auto_mode = 1;
 
 	/* Verify CR/LF */
-	if (raw->cr != '\r' || raw->lf != '\n') {
+	if (raw->cr != '\r' || raw->lf != '\n')
+		return DECODE_ERR_TERMINATION;
+
+	return DECODE_OK;
+}
+
+/* Decode a frame from the stream.
+ * A valid frame is recorded, if a capture file is active.
+ * Bad frames are not recorded. So a replay sees each valid frame
+ * exactly once, even if re-framing slides over its bytes.
+ * On a bad frame, rx_start is rewound to the byte after the start
+ * of the frame and re-framing is requested. So a valid frame that
+ * starts within the bad one is not lost. */
+static int parse_sample(struct es51984 *es,
+			struct es51984_raw_sample *raw,
+			struct es51984_sample *sample)
+{
+	enum decode_error err;
+
+	if (digits_sanity_check(raw))
+		err = DECODE_ERR_DIGITS;
+	else
+		err = decode_frame(sample->board, raw, digits_count(raw), sample);
+
+	switch (err) {
+	case DECODE_OK:
+		es->stats.frames++;
+		if (es->capture)
+			capture_frame(es, raw);
+		return 0;
+	case DECODE_ERR_DIGITS:
+		es->stats.bad_digits++;
+		fprintf(stderr, PFX "Got invalid digits %02X %02X %02X %02X (func %02X)\n",
+			raw->digit3, raw->digit2, raw->digit1, raw->digit0,
+			raw->function);
+		break;
+	case DECODE_ERR_FUNCTION:
+		es->stats.bad_function++;
+		fprintf(stderr, PFX "Got invalid function code %02X\n",
+			raw->function);
+		break;
+	case DECODE_ERR_RANGE:
+		es->stats.bad_range++;
+		fprintf(stderr, PFX "Got an invalid range code %02X (func %02X)\n",
+			raw->range, raw->function);
+		break;
+	case DECODE_ERR_STATUS:
+		es->stats.bad_status++;
+		fprintf(stderr, PFX "Got invalid status code %02X (func %02X)\n",
+			raw->status, raw->function);
+		break;
+	case DECODE_ERR_OPTION1:
+		es->stats.bad_option1++;
+		fprintf(stderr, PFX "Got invalid option1 code %02X (func %02X)\n",
+			raw->option1, raw->function);
+		break;
+	case DECODE_ERR_OPTION2:
+		es->stats.bad_option2++;
+		fprintf(stderr, PFX "Got invalid option2 code %02X (func %02X)\n",
+			raw->option2, raw->function);
+		break;
+	case DECODE_ERR_TERMINATION:
+		es->stats.bad_termination++;
 		fprintf(stderr, PFX "Got invalid packet termination %02X %02X\n",
 			raw->cr, raw->lf);
-		goto error;
+		break;
 	}
+	es->rx_start -= sizeof(struct es51984_raw_sample) - 1;
+	es->reframe = 1;
+	return -EBADMSG;
+}
 
-	return 0;
+/* Validate a frame and get its unsigned digit count.
+ * This checks everything that doesn't depend on the decoder table.
+ * The range code is not checked here, because some functions ignore it.
+ * Returns the digit count or -1, if the frame is invalid. */
+static int32_t check_frame(const struct es51984_raw_sample *raw)
+{
+	if (digits_sanity_check(raw))
+		return -1;
+	if ((raw->function & 0xF0) != 0x30 ||
+	    (raw->status & 0xF0) != 0x30 ||
+	    (raw->option1 & 0xF0) != 0x30 ||
+	    (raw->option2 & 0xF0) != 0x30 ||
+	    raw->cr != '\r' || raw->lf != '\n')
+		return -1;
+	return digits_count(raw);
+}
 
-invalid_range:
-	fprintf(stderr, PFX "Got an invalid range code %02X (func %02X)\n",
-		raw->range, raw->function);
-error:
-	es->synced = 0; /* We lost synchronization */
-	return -EPIPE;
+static unsigned int check_frames_scalar(const struct es51984_raw_sample *raw,
+					unsigned int nr_frames,
+					int32_t *counts)
+{
+	unsigned int i, nr_valid = 0;
+
+	for (i = 0; i < nr_frames; i++) {
+		counts[i] = check_frame(&raw[i]);
+		nr_valid += (counts[i] >= 0);
+	}
+
+	return nr_valid;
+}
+
+#ifdef ES51984_X86_SIMD
+/* The SIMD kernels load 16 bytes per 11 byte frame. The last frame
+ * would be read beyond the end of the buffer. It is checked by the
+ * scalar code instead.
+ *
+ * Per frame byte:
+ *  - (byte & nibble_mask) must equal nibble_want.
+ *    That checks the 0x3X payload bytes and the CR/LF termination.
+ *    The range code byte is not checked.
+ *  - byte must not be bigger than digit_limit.
+ *    That checks the digit limits 4, 9, 9, 9.
+ * The digit count is computed with one multiply-add of the
+ * low nibbles against the digit weights 1000, 100, 10, 1.
+ */
+#define NIBBLE_MASK	0x00, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0,	\
+			0xF0, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00
+#define NIBBLE_WANT	0x00, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,	\
+			0x30, 0x0D, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00
+#define DIGIT_LIMIT	0xFF, 0x34, 0x39, 0x39, 0x39, 0xFF, 0xFF, 0xFF,	\
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+#define DIGIT_WEIGHTS	0, 1000, 100, 10, 1, 0, 0, 0
+
+static const uint8_t nibble_mask_bytes[32] = { NIBBLE_MASK, NIBBLE_MASK, };
+static const uint8_t nibble_want_bytes[32] = { NIBBLE_WANT, NIBBLE_WANT, };
+static const uint8_t digit_limit_bytes[32] = { DIGIT_LIMIT, DIGIT_LIMIT, };
+static const int16_t digit_weights[16] = { DIGIT_WEIGHTS, DIGIT_WEIGHTS, };
+
+__attribute__((__target__("sse2")))
+static unsigned int check_frames_sse2(const struct es51984_raw_sample *raw,
+				      unsigned int nr_frames,
+				      int32_t *counts)
+{
+	const __m128i nibble_mask = _mm_loadu_si128((const void *)nibble_mask_bytes);
+	const __m128i nibble_want = _mm_loadu_si128((const void *)nibble_want_bytes);
+	const __m128i digit_limit = _mm_loadu_si128((const void *)digit_limit_bytes);
+	const __m128i weights = _mm_loadu_si128((const void *)digit_weights);
+	const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, ok, sum;
+	unsigned int i, nr_valid = 0;
+	int valid;
+
+	for (i = 0; i + 1 < nr_frames; i++) {
+		v = _mm_loadu_si128((const void *)&raw[i]);
+		ok = _mm_and_si128(
+			_mm_cmpeq_epi8(_mm_and_si128(v, nibble_mask), nibble_want),
+			_mm_cmpeq_epi8(_mm_subs_epu8(v, digit_limit), zero));
+		valid = (_mm_movemask_epi8(ok) == 0xFFFF);
+
+		sum = _mm_madd_epi16(_mm_unpacklo_epi8(_mm_and_si128(v, low_nibbles),
+						       zero),
+				     weights);
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		counts[i] = valid ? _mm_cvtsi128_si32(sum) : -1;
+		nr_valid += valid;
+	}
+
+	return nr_valid + check_frames_scalar(&raw[i], nr_frames - i, &counts[i]);
+}
+
+__attribute__((__target__("avx2")))
+static unsigned int check_frames_avx2(const struct es51984_raw_sample *raw,
+				      unsigned int nr_frames,
+				      int32_t *counts)
+{
+	const __m256i nibble_mask = _mm256_loadu_si256((const void *)nibble_mask_bytes);
+	const __m256i nibble_want = _mm256_loadu_si256((const void *)nibble_want_bytes);
+	const __m256i digit_limit = _mm256_loadu_si256((const void *)digit_limit_bytes);
+	const __m256i weights = _mm256_loadu_si256((const void *)digit_weights);
+	const __m256i low_nibbles = _mm256_set1_epi8(0x0F);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, ok, sum;
+	unsigned int i, nr_valid = 0;
+	uint32_t mask;
+	int valid0, valid1;
+
+	/* Two frames per iteration. One per 128 bit lane. */
+	for (i = 0; i + 2 < nr_frames; i += 2) {
+		v = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const void *)&raw[i])),
+			_mm_loadu_si128((const void *)&raw[i + 1]), 1);
+		ok = _mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_and_si256(v, nibble_mask), nibble_want),
+			_mm256_cmpeq_epi8(_mm256_subs_epu8(v, digit_limit), zero));
+		mask = (uint32_t)_mm256_movemask_epi8(ok);
+		valid0 = ((mask & 0xFFFF) == 0xFFFF);
+		valid1 = ((mask >> 16) == 0xFFFF);
+
+		sum = _mm256_madd_epi16(_mm256_unpacklo_epi8(_mm256_and_si256(v, low_nibbles),
+							     zero),
+					weights);
+		sum = _mm256_add_epi32(sum, _mm256_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm256_add_epi32(sum, _mm256_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+		counts[i] = valid0 ? _mm256_extract_epi32(sum, 0) : -1;
+		counts[i + 1] = valid1 ? _mm256_extract_epi32(sum, 4) : -1;
+		nr_valid += valid0 + valid1;
+	}
+
+	return nr_valid + check_frames_scalar(&raw[i], nr_frames - i, &counts[i]);
+}
+#endif /* ES51984_X86_SIMD */
+
+typedef unsigned int (*check_frames_func_t)(const struct es51984_raw_sample *raw,
+					    unsigned int nr_frames,
+					    int32_t *counts);
+
+/* Select the fastest frame checker this CPU supports. */
+static check_frames_func_t select_check_frames(void)
+{
+#ifdef ES51984_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return check_frames_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return check_frames_sse2;
+#endif
+	return check_frames_scalar;
+}
+
+unsigned int es51984_check_frames(const struct es51984_raw_sample *raw,
+				  unsigned int nr_frames,
+				  int32_t *counts)
+{
+	static check_frames_func_t selected;
+	check_frames_func_t check_frames;
+
+	/* This is called by concurrent decoder threads.
+	 * Racing selections store the same pointer. */
+	check_frames = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+	if (!check_frames) {
+		check_frames = select_check_frames();
+		__atomic_store_n(&selected, check_frames, __ATOMIC_RELAXED);
+	}
+
+	return check_frames(raw, nr_frames, counts);
+}
+
+unsigned int es51984_decode_frames(enum es51984_board_type board,
+				   const struct es51984_raw_sample *raw,
+				   unsigned int nr_frames,
+				   struct es51984_sample *samples,
+				   int *errors)
+{
+	int32_t counts[256];
+	unsigned int i, j, chunk, nr_decoded = 0;
+
+	for (i = 0; i < nr_frames; i += chunk) {
+		chunk = nr_frames - i;
+		if (chunk > ARRAY_SIZE(counts))
+			chunk = ARRAY_SIZE(counts);
+		es51984_check_frames(&raw[i], chunk, counts);
+
+		for (j = 0; j < chunk; j++) {
+			struct es51984_sample *sample = &samples[i + j];
+
+			memset(sample, 0, sizeof(*sample));
+			sample->board = board;
+			if (counts[j] < 0 ||
+			    decode_frame(board, &raw[i + j], counts[j], sample)) {
+				errors[i + j] = -EPIPE;
+				continue;
+			}
+			errors[i + j] = 0;
+			nr_decoded++;
+		}
+	}
+
+	return nr_decoded;
+}
+
+static void init_sample(struct es51984 *es,
+			struct es51984_sample *sample)
+{
+	memset(sample, 0, sizeof(*sample));
+	sample->value = 0.0;
+	sample->board = es->board;
+	sample->mono_ns = es->frame_mark.mono;
+	sample->realtime_ns = es->frame_mark.real;
+	sample->first_mono_ns = es->frame_first_mono;
+}
+
+int es51984_get_sample_timeout(struct es51984 *es,
+			       struct es51984_sample *sample,
+			       int timeout_ms,
+			       int debug)
+{
+	struct es51984_raw_sample *raw;
+	int err;
+
+	if (!es->synced)
+		return -EPIPE; /* Must sync first! */
+
+	init_sample(es, sample);
+
+	err = read_sample(es, &raw, timeout_ms);
+	if (err)
+		return err;
+	sample->mono_ns = es->frame_mark.mono;
+	sample->realtime_ns = es->frame_mark.real;
+	sample->first_mono_ns = es->frame_first_mono;
+	if (debug) {
+		dump_raw_sample("es51984 raw sample", raw);
+		printf("Syscalls: %lu\n", es->syscalls - es->syscalls_last);
+	}
+	es->syscalls_last = es->syscalls;
+
+	return parse_sample(es, raw, sample);
 }
 
 int es51984_get_sample(struct es51984 *es,
 		       struct es51984_sample *sample,
 		       int blocking,
 		       int debug)
+{
+	return es51984_get_sample_timeout(es, sample,
+					  blocking ? -1 : 0, debug);
+}
+
+int es51984_get_samples(struct es51984 *es,
+			struct es51984_sample *samples,
+			int *errors,
+			unsigned int nr_samples,
+			int timeout_ms)
 {
 	struct es51984_raw_sample *raw;
+	unsigned int i;
 	int err;
 
 	if (!es->synced)
 		return -EPIPE; /* Must sync first! */
+	if (!nr_samples)
+		return 0;
 
-	memset(sample, 0, sizeof(*sample));
-	sample->value = 0.0;
-	sample->board = es->board;
-
-	err = read_sample(es, &raw, blocking);
+	err = rx_wait_frame(es, timeout_ms);
 	if (err)
 		return err;
-	if (debug)
-		dump_raw_sample("es51984 raw sample", raw);
-	err = parse_sample(es, raw, sample);
+
+	/* Decode everything that is buffered.
+	 * A fast replay can read on without ever blocking. */
+	for (i = 0; i < nr_samples; i++) {
+		while (!rx_frame_ready(es)) {
+			if (!es->replay || es->replay_realtime)
+				goto out;
+			if (rx_fill(es) <= 0)
+				goto out;
+		}
+		raw = rx_take_frame(es);
+
+		init_sample(es, &samples[i]);
+		errors[i] = parse_sample(es, raw, &samples[i]);
+	}
+out:
+	es->syscalls_last = es->syscalls;
+
+	return (int)i;
+}
+
+/* Check whether a frame decodes without errors.
+ * This is the validation of parse_sample() without the decoding. */
+static int frame_valid(unsigned int board,
+		       const struct es51984_raw_sample *raw)
+{
+	const struct es51984_func_desc *desc;
+
+	if (check_frame(raw) < 0)
+		return 0;
+	if (board >= ARRAY_SIZE(decode_table))
+		board = ES51984_BOARD_UNKNOWN;
+	desc = &decode_table[board][FUNC_IDX(raw->function)];
+	if (!(desc->flags & DECODE_VALID))
+		return 0;
+	if (!(desc->flags & DECODE_NORANGE) &&
+	    (unsigned int)(raw->range ^ 0x30) >= desc->nr_ranges)
+		return 0;
+	return 1;
+}
+
+int es51984_peek_frames(struct es51984 *es,
+			const struct es51984_raw_sample **frames,
+			unsigned int max_frames,
+			int timeout_ms)
+{
+	struct es51984_raw_sample *raw;
+	struct es51984_sample sample;
+	unsigned int i, avail;
+	int err;
+
+	es->nr_peeked = 0;
+	if (!es->synced)
+		return -EPIPE; /* Must sync first! */
+	if (!max_frames)
+		return 0;
+
+	err = rx_wait_frame(es, timeout_ms);
 	if (err)
 		return err;
+	if (es->replay && !es->replay_realtime) {
+		/* A fast replay can read on without ever blocking. */
+		while (rx_avail(es) / sizeof(*raw) < max_frames) {
+			if (rx_fill(es) <= 0)
+				break;
+		}
+	}
+	es->syscalls_last = es->syscalls;
+
+	raw = (void *)(es->rxbuf + es->rx_start);
+	avail = rx_avail(es) / sizeof(*raw);
+	if (max_frames > avail)
+		max_frames = avail;
+	for (i = 0; i < max_frames; i++) {
+		if (!frame_valid(es->board, &raw[i]))
+			break;
+	}
+	if (!i) {
+		/* Drop the bad frame exactly like the decoder does. */
+		raw = rx_take_frame(es);
+		init_sample(es, &sample);
+		return parse_sample(es, raw, &sample);
+	}
+	es->nr_peeked = i;
+	*frames = raw;
+
+	return (int)i;
+}
+
+int es51984_release_frames(struct es51984 *es, unsigned int nr_frames)
+{
+	struct es51984_raw_sample *raw;
+	unsigned int i, nr_peeked = es->nr_peeked;
+
+	if (nr_frames > nr_peeked)
+		return -EINVAL;
+	for (i = 0; i < nr_frames; i++) {
+		raw = rx_take_frame(es);
+		if (es->capture)
+			capture_frame(es, raw);
+	}
+	/* The rest of the batch is still valid and can be released
+	 * by a further call. */
+	es->nr_peeked = nr_peeked - nr_frames;
+	es->stats.frames += nr_frames;
 
 	return 0;
 }
 
+double es51984_packed_value(const struct es51984_packed_sample *packed)
+{
+	int32_t count = packed->count;
+	int exponent = packed->exponent;
+	double value;
+
+	/* Same as decode_frame(). Decode the magnitude, then apply
+	 * the sign. So -0.0 and -DBL_MAX are restored, too. */
+	if (packed->flags & ES51984_PACKED_OL) {
+		value = DBL_MAX;
+	} else {
+		if (count < 0)
+			count = -count;
+		if (exponent < 0)
+			value = (double)count / pow10_table[-exponent];
+		else
+			value = (double)count * pow10_table[exponent];
+	}
+	if (packed->flags & ES51984_PACKED_SIGN)
+		value = -value;
+
+	return value;
+}
+
+int es51984_pack_sample(struct es51984_packed_sample *packed,
+			const struct es51984_sample *sample)
+{
+	double value;
+	uint8_t flags = 0;
+
+	if (sample->exponent <= -(int)ARRAY_SIZE(pow10_table) ||
+	    sample->exponent >= (int)ARRAY_SIZE(pow10_table) ||
+	    (unsigned int)sample->function > 0xFF ||
+	    (unsigned int)sample->board > 0xF ||
+	    (unsigned int)sample->range > 0xF)
+		return -EINVAL;
+
+	if (sample->dc_mode)
+		flags |= ES51984_PACKED_DC;
+	if (sample->auto_mode)
+		flags |= ES51984_PACKED_AUTO;
+	if (sample->overflow)
+		flags |= ES51984_PACKED_OL;
+	if (sample->degree)
+		flags |= ES51984_PACKED_DEGREE;
+	if (sample->batt_low)
+		flags |= ES51984_PACKED_BATT;
+	if (sample->hold)
+		flags |= ES51984_PACKED_HOLD;
+	if (signbit(sample->value))
+		flags |= ES51984_PACKED_SIGN;
+
+	packed->count = sample->count;
+	packed->exponent = (int8_t)sample->exponent;
+	packed->function = (uint8_t)sample->function;
+	packed->board_range = (uint8_t)((unsigned int)sample->board << 4 |
+					(unsigned int)sample->range);
+	packed->flags = flags;
+
+	/* The value is not stored. It must follow from the rest. */
+	value = es51984_packed_value(packed);
+	if (memcmp(&value, &sample->value, sizeof(value)))
+		return -EINVAL;
+
+	return 0;
+}
+
+void es51984_unpack_sample(struct es51984_sample *sample,
+			   const struct es51984_packed_sample *packed)
+{
+	memset(sample, 0, sizeof(*sample));
+	sample->function = (enum es51984_func)packed->function;
+	sample->value = es51984_packed_value(packed);
+	sample->count = packed->count;
+	sample->exponent = packed->exponent;
+	sample->range = packed->board_range & 0xF;
+	sample->dc_mode = !!(packed->flags & ES51984_PACKED_DC);
+	sample->auto_mode = !!(packed->flags & ES51984_PACKED_AUTO);
+	sample->overflow = !!(packed->flags & ES51984_PACKED_OL);
+	sample->degree = !!(packed->flags & ES51984_PACKED_DEGREE);
+	sample->batt_low = !!(packed->flags & ES51984_PACKED_BATT);
+	sample->hold = !!(packed->flags & ES51984_PACKED_HOLD);
+	sample->board = (enum es51984_board_type)(packed->board_range >> 4);
+}
+
 const char * es51984_get_units(const struct es51984_sample *sample)
 {
 	switch (sample->function) {
@@ -594,109 +1367,85 @@ const char * es51984_get_units(const struct es51984_sample *sample)
 
 int es51984_discard(struct es51984 *es)
 {
-	struct es51984_sample sample;
-	int err;
+	unsigned int frames;
+	int res;
 
 	if (!es->synced)
 		return -EPIPE; /* Must sync first! */
+	es->nr_peeked = 0;
 
-	/* Read samples until the buffer is empty */
-	while (1) {
-		err = es51984_get_sample(es, &sample, 0, 0);
-		if (err == -EAGAIN)
-			break; /* No more samples */
-		if (err)
-			return err;
-	}
-	if (es->sample_ptr) {
-		/* We have a partially received sample. Discard it.
-		 * Wait for the end of the sample. */
-		err = es51984_sync(es);
-		if (err)
-			return err;
+	if (es->replay) {
+		/* Only drop what is buffered. Don't skip the capture. */
+		frames = rx_avail(es) / sizeof(struct es51984_raw_sample);
+		es->rx_start += frames * sizeof(struct es51984_raw_sample);
+		return 0;
 	}
 
-	return 0;
-}
+	res = set_blocking(es, 0);
+	if (res)
+		return res;
 
-static void tv_add_msec(struct timeval *tv, unsigned int msec)
-{
-	tv->tv_usec += msec * 1000;
-	while (tv->tv_usec > 1000000) {
-		tv->tv_sec++;
-		tv->tv_usec -= 1000000;
-	}
-}
+	/* Drain the tty in large chunks and drop all complete frames.
+	 * A partially received frame is kept. It will be completed
+	 * by the next read. */
+	do {
+		frames = rx_avail(es) / sizeof(struct es51984_raw_sample);
+		es->rx_start += frames * sizeof(struct es51984_raw_sample);
+		res = rx_fill(es);
+		if (res < 0)
+			return res;
+	} while (res > 0);
 
-static int tv_after(const struct timeval *a, const struct timeval *b)
-{
-	if (a->tv_sec > b->tv_sec)
-		return 1;
-	if (a->tv_sec == b->tv_sec && a->tv_usec > b->tv_usec)
-		return 1;
 	return 0;
 }
 
 int es51984_sync(struct es51984 *es)
 {
-	ssize_t res;
-	int err;
-	unsigned char prev = 0, c;
-	struct timeval to, tv;
-	struct timespec ts;
+	int err, res;
+	int timeout_ms = 0;
+	int64_t deadline;
 
-	/* We sync to the final CR/LF sequence of the data stream. */
+	/* We sync to the final CR/LF sequence of a frame.
+	 * The bytes that are already buffered are scanned first.
+	 * Nothing is flushed, so no valid frame is lost. */
 
-	err = gettimeofday(&to, NULL);
-	if (err) {
-		fprintf(stderr, PFX "Failed to get time of day: %s\n",
-			strerror(errno));
-		return -EIO;
-	}
 	switch (es->board) {
 	case ES51984_BOARD_UNKNOWN:
 	case ES51984_BOARD_AMPROBE_35XPA:
-		tv_add_msec(&to, 3000); /* 3 seconds */
+		timeout_ms = 3000; /* 3 seconds */
 		break;
 	}
+	deadline = clock_msec() + timeout_ms;
 
 	err = set_blocking(es, 0);
 	if (err)
 		return err;
-	tcflush(es->fd, TCIFLUSH);
-	while (1) {
-		err = gettimeofday(&tv, NULL);
-		if (err) {
-			fprintf(stderr, PFX "Failed to get time of day: %s\n",
-				strerror(errno));
-			return -EIO;
-		}
-		if (tv_after(&tv, &to)) {
-			fprintf(stderr, PFX "Sync: Timeout. Is the device connected?\n");
-			return -ETIME;
-		}
-		res = read(es->fd, &c, 1);
-		if (res == 0) {
-			ts.tv_sec = 0;
-			ts.tv_nsec = 1000*1000;
-			nanosleep(&ts, &ts);
+	es->reframe = 0;
+	es->nr_peeked = 0;
+	while (!rx_resync(es)) {
+		/* Check the deadline in every iteration. A device that
+		 * sends data, which never forms a frame, must time out, too. */
+		if (clock_msec() >= deadline)
+			goto timeout;
+		res = rx_fill(es);
+		if (res < 0)
+			return res;
+		if (res > 0)
 			continue;
-		}
-		if (res != 1) {
-			fprintf(stderr, PFX "Sync: Read failed: %s\n",
-				strerror(errno));
-			return -EIO;
-		}
-		if (prev == '\r' && c == '\n') {
-			/* Got it! */
-			break;
-		}
-		prev = c;
+		err = wait_input(es, timeout_ms, deadline);
+		if (err == -EAGAIN)
+			goto timeout;
+		if (err)
+			return err;
 	}
 	es->synced = 1;
-	es->sample_ptr = 0;
+	es->stats.resyncs++;
 
 	return 0;
+
+timeout:
+	fprintf(stderr, PFX "Sync: Timeout. Is the device connected?\n");
+	return -ETIME;
 }
 
 struct es51984 * es51984_init(enum es51984_board_type board,
@@ -743,6 +1492,13 @@ struct es51984 * es51984_init(enum es51984_board_type board,
 			tty, strerror(errno));
 		goto err_close;
 	}
+	/* Cache the attributes as the driver actually applied them. */
+	err = tcgetattr(es->fd, &es->ios);
+	if (err < 0) {
+		fprintf(stderr, PFX "Failed to get tty attributes on %s: %s\n",
+			tty, strerror(errno));
+		goto err_close;
+	}
 	err = tcflow(es->fd, TCION);
 	if (err) {
 		fprintf(stderr, PFX "Failed to enable input on %s: %s\n",
@@ -759,10 +1515,103 @@ err_free:
 	return NULL;
 }
 
+int es51984_get_fd(struct es51984 *es)
+{
+	if (es->replay)
+		return -1;
+	return es->fd;
+}
+
+unsigned long es51984_get_syscalls(struct es51984 *es)
+{
+	return es->syscalls;
+}
+
+void es51984_get_stats(struct es51984 *es, struct es51984_stats *stats)
+{
+	*stats = es->stats;
+	stats->syscalls = es->syscalls;
+}
+
+int es51984_record(struct es51984 *es, const char *path)
+{
+	struct es51984_capture_header hdr;
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, PFX "Failed to open capture %s: %s\n",
+			path, strerror(errno));
+		return -EIO;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ES51984_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(ES51984_CAPTURE_VERSION);
+	hdr.board = htole32((uint32_t)es->board);
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		fprintf(stderr, PFX "Failed to write capture %s\n", path);
+		fclose(f);
+		return -EIO;
+	}
+
+	if (es->capture)
+		fclose(es->capture);
+	es->capture = f;
+
+	return 0;
+}
+
+struct es51984 * es51984_init_replay(const char *path, int realtime)
+{
+	struct es51984_capture_header hdr;
+	struct es51984 *es;
+
+	es = malloc(sizeof(*es));
+	if (!es) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	memset(es, 0, sizeof(*es));
+
+	es->tty = path;
+	es->fd = -1;
+	es->replay_realtime = realtime;
+	es->replay = fopen(path, "rb");
+	if (!es->replay) {
+		fprintf(stderr, PFX "Failed to open capture %s: %s\n",
+			path, strerror(errno));
+		goto err_free;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, es->replay) != 1 ||
+	    memcmp(hdr.magic, ES51984_CAPTURE_MAGIC, sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, PFX "%s is not a capture file\n", path);
+		goto err_close;
+	}
+	if (le32toh(hdr.version) != ES51984_CAPTURE_VERSION) {
+		fprintf(stderr, PFX "Unsupported capture version %u in %s\n",
+			(unsigned int)le32toh(hdr.version), path);
+		goto err_close;
+	}
+	es->board = (enum es51984_board_type)le32toh(hdr.board);
+
+	return es;
+
+err_close:
+	fclose(es->replay);
+err_free:
+	free(es);
+	return NULL;
+}
+
 void es51984_exit(struct es51984 *es)
 {
 	if (!es)
 		return;
-	close(es->fd);
+	if (es->capture)
+		fclose(es->capture);
+	if (es->replay)
+		fclose(es->replay);
+	if (es->fd >= 0)
+		close(es->fd);
 	free(es);
 }
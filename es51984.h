@@ -3,6 +3,8 @@
 
 /* Cyrustek ES 51984 digital multimeter RS232 signal interpreter. */
 
+#include <stdint.h>
+
 
 /** struct es51984 - ES51984 device data structure.
  * This structure is opaque to the API user. */
@@ -36,10 +38,69 @@ enum es51984_func {
 	ES51984_FUNC_ADP3		= ES51984_PACK(0xA), /* ADP3 */
 };
 
+/** struct es51984_raw_sample - A raw frame as sent by the device.
+ * All payload bytes carry 0x3 in the high nibble.
+ */
+struct es51984_raw_sample {
+	uint8_t range;
+	uint8_t digit3;
+	uint8_t digit2;
+	uint8_t digit1;
+	uint8_t digit0;
+	uint8_t function;
+	uint8_t status;
+	uint8_t option1;
+	uint8_t option2;
+	uint8_t cr;
+	uint8_t lf;
+} __attribute__((__packed__));
+
+#define ES51984_DIGIT_MASK	0x0F
+#define ES51984_STATUS_JUDGE	0x08
+#define ES51984_STATUS_SIGN	0x04
+#define ES51984_STATUS_BATT	0x02
+#define ES51984_STATUS_OL	0x01
+#define ES51984_OPT1_HOLD	0x08
+#define ES51984_OPT2_DC		0x08
+#define ES51984_OPT2_AC		0x04
+#define ES51984_OPT2_AUTO	0x02
+
+/* Capture file format.
+ * A capture starts with a struct es51984_capture_header, followed by
+ * one struct es51984_capture_record per frame.
+ * All integers are little-endian.
+ */
+#define ES51984_CAPTURE_MAGIC		"ES51984C"
+#define ES51984_CAPTURE_VERSION		1
+
+/** struct es51984_capture_header - Capture file header.
+ * @magic: ES51984_CAPTURE_MAGIC. Not NUL terminated.
+ * @version: ES51984_CAPTURE_VERSION.
+ * @board: The enum es51984_board_type of the recorded device.
+ */
+struct es51984_capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t board;
+} __attribute__((__packed__));
+
+/** struct es51984_capture_record - One recorded frame.
+ * @timestamp: CLOCK_REALTIME arrival time in nanoseconds.
+ * @raw: The frame exactly as it was received.
+ */
+struct es51984_capture_record {
+	uint64_t timestamp;
+	struct es51984_raw_sample raw;
+} __attribute__((__packed__));
+
 /** struct es51984_sample - Data sample of a measurement.
  *
  * @function: The active device function.
  * @value: The measured value.
+ * @count: The measured value as signed digit count.
+ *         value = count * 10^exponent, unless overflow is set.
+ * @exponent: The decimal exponent of count. This is given by the range.
+ * @range: The range index within the function, starting at 0.
  * @dc_mode: Boolean. DC or AC mode.
  * @auto_mode: Boolean. Automatic or manual mode.
  * @overflow: Boolean. Overflow condition present.
@@ -50,6 +111,9 @@ enum es51984_func {
 struct es51984_sample {
 	enum es51984_func function;
 	double value;
+	int32_t count;
+	int exponent;
+	int range;
 	int dc_mode;
 	int auto_mode;
 	int overflow;
@@ -58,8 +122,78 @@ struct es51984_sample {
 	int hold;
 
 	enum es51984_board_type board;
+
+	/* Arrival time of the frame in nanoseconds. This is the time of
+	 * the read() that delivered the terminating byte of the frame.
+	 * Replays reproduce the recorded times. */
+	int64_t mono_ns;	/* CLOCK_MONOTONIC */
+	int64_t realtime_ns;	/* CLOCK_REALTIME */
+
+	/* CLOCK_MONOTONIC time of the read() that delivered the first
+	 * byte of the frame. mono_ns - first_mono_ns is the time it took
+	 * to receive the frame. */
+	int64_t first_mono_ns;
 };
 
+/* Flags of struct es51984_packed_sample. */
+#define ES51984_PACKED_DC	0x01 /* dc_mode */
+#define ES51984_PACKED_AUTO	0x02 /* auto_mode */
+#define ES51984_PACKED_OL	0x04 /* overflow */
+#define ES51984_PACKED_DEGREE	0x08 /* degree */
+#define ES51984_PACKED_BATT	0x10 /* batt_low */
+#define ES51984_PACKED_HOLD	0x20 /* hold */
+#define ES51984_PACKED_SIGN	0x40 /* The value is negative */
+
+/** struct es51984_packed_sample - Compact form of a sample.
+ *
+ * This holds the measurement of a struct es51984_sample in 8 bytes.
+ * It is meant for large in-memory histories. The arrival times are
+ * not part of it.
+ *
+ * @count: The signed digit count.
+ * @exponent: The decimal exponent of count.
+ * @function: The enum es51984_func.
+ * @board_range: The board type in the high nibble and
+ *               the range index in the low nibble.
+ * @flags: ES51984_PACKED_* flags.
+ */
+struct es51984_packed_sample {
+	int32_t count;
+	int8_t exponent;
+	uint8_t function;
+	uint8_t board_range;
+	uint8_t flags;
+};
+
+/** es51984_pack_sample - Convert a sample to its compact form.
+ *
+ * Returns zero on success. Returns -EINVAL, if the sample can't be
+ * converted losslessly. That never happens for decoded samples.
+ *
+ * @packed: Returns the compact sample.
+ * @sample: The sample.
+ */
+int es51984_pack_sample(struct es51984_packed_sample *packed,
+			const struct es51984_sample *sample);
+
+/** es51984_unpack_sample - Convert a compact sample back.
+ *
+ * This restores all fields of the packed sample, including the
+ * exact value. The arrival times are set to zero.
+ *
+ * @sample: Returns the sample.
+ * @packed: The compact sample.
+ */
+void es51984_unpack_sample(struct es51984_sample *sample,
+			   const struct es51984_packed_sample *packed);
+
+/** es51984_packed_value - Get the value of a compact sample.
+ * This is bit-identical to the value of the original sample.
+ *
+ * @packed: The compact sample.
+ */
+double es51984_packed_value(const struct es51984_packed_sample *packed);
+
 /** es51984_get_units - Get units identifier string for the value of a sample.
  * @sample: The sample.
  */
@@ -69,8 +203,11 @@ const char * es51984_get_units(const struct es51984_sample *sample);
  *
  * Returns zero on success, or a negative error on failure.
  * If non-blocking and no sample is available, returns -EAGAIN.
- * Returns -EPIPE, if synchronization was lost. es51984_sync() must
- * be called to resolve this error condition.
+ * Returns -EPIPE, if the interface was never synchronized.
+ * es51984_sync() must be called first.
+ * Returns -EBADMSG, if a bad frame was received. The frame is dropped
+ * and the interface re-frames to the next valid frame boundary in the
+ * received data on the next call. No es51984_sync() is needed.
  *
  * @es: The interface.
  * @sample: Pointer to the sample buffer.
@@ -82,6 +219,133 @@ int es51984_get_sample(struct es51984 *es,
 		       int blocking,
 		       int debug);
 
+/** es51984_get_sample_timeout - Read a sample with a timeout.
+ *
+ * This is like es51984_get_sample(), but waits at most timeout_ms
+ * milliseconds for the sample to arrive. The caller sleeps in poll()
+ * and is woken up as soon as data arrives.
+ * Returns -EAGAIN, if the timeout expired before a full sample arrived.
+ *
+ * @es: The interface.
+ * @sample: Pointer to the sample buffer.
+ * @timeout_ms: The timeout. 0 is non-blocking. Negative blocks forever.
+ * @debug: If true, enable debug messages.
+ */
+int es51984_get_sample_timeout(struct es51984 *es,
+			       struct es51984_sample *sample,
+			       int timeout_ms,
+			       int debug);
+
+/** es51984_get_samples - Read a batch of samples.
+ *
+ * Decodes up to nr_samples of the buffered samples. The tty is only
+ * read, if no complete sample is buffered. In that case this waits
+ * at most timeout_ms milliseconds for the first sample to arrive.
+ *
+ * Returns the number of filled entries in samples and errors,
+ * or a negative error code. Returns -EAGAIN, if no sample arrived
+ * in time. errors[i] is zero, if samples[i] is valid. Otherwise it is
+ * a negative error code. If it is -EBADMSG, a bad frame was dropped
+ * and the batch continues at the next valid frame boundary.
+ *
+ * @es: The interface.
+ * @samples: Array of nr_samples sample buffers.
+ * @errors: Array of nr_samples error codes.
+ * @nr_samples: The maximum number of samples to read.
+ * @timeout_ms: The timeout. 0 is non-blocking. Negative blocks forever.
+ */
+int es51984_get_samples(struct es51984 *es,
+			struct es51984_sample *samples,
+			int *errors,
+			unsigned int nr_samples,
+			int timeout_ms);
+
+/** es51984_peek_frames - Get a batch of raw frames without decoding.
+ *
+ * Points frames to the valid raw frames at the start of the receive
+ * buffer. Nothing is decoded or copied. The frames are validated like
+ * es51984_get_samples() does, including the range and function codes.
+ * The batch ends before the first invalid frame. The tty is only read,
+ * if no complete frame is buffered. In that case this waits at most
+ * timeout_ms milliseconds for the first frame to arrive.
+ *
+ * The frames stay buffered until they are consumed with
+ * es51984_release_frames(). The pointer is valid until the release
+ * or the next call of any other function on the interface.
+ * Peeking again without a release returns the same frames.
+ *
+ * Returns the number of frames, or a negative error code.
+ * Returns -EAGAIN, if no frame arrived in time. Returns -EBADMSG,
+ * if the first frame is invalid. It is dropped like a bad sample
+ * and the next call continues at the next valid frame boundary.
+ *
+ * @es: The interface.
+ * @frames: Returns a pointer to an array of the frames.
+ * @max_frames: The maximum number of frames.
+ * @timeout_ms: The timeout. 0 is non-blocking. Negative blocks forever.
+ */
+int es51984_peek_frames(struct es51984 *es,
+			const struct es51984_raw_sample **frames,
+			unsigned int max_frames,
+			int timeout_ms);
+
+/** es51984_release_frames - Consume peeked raw frames.
+ *
+ * Consumes the next nr_frames of the frames returned by the last
+ * es51984_peek_frames(). The remaining frames stay buffered. They can
+ * be released by further calls or are returned again by the next peek.
+ * The frames are recorded, if es51984_record() is active, and counted
+ * as decoded frames in the statistics.
+ *
+ * Returns zero on success. Returns -EINVAL, if nr_frames is more than
+ * the number of peeked and not yet released frames. No frame is
+ * released then. Reading, discarding or re-syncing frames ends the
+ * peek, so that no frame can be released afterwards.
+ *
+ * @es: The interface.
+ * @nr_frames: The number of frames to consume.
+ */
+int es51984_release_frames(struct es51984 *es, unsigned int nr_frames);
+
+/** es51984_check_frames - Validate a buffer of raw frames.
+ *
+ * Checks the high nibbles, the digit limits and the CR/LF termination
+ * of nr_frames contiguous raw frames. The range and function codes
+ * are not checked against the decoder table.
+ * This uses SSE2 or AVX2, if the CPU supports it.
+ *
+ * Returns the number of valid frames.
+ *
+ * @raw: Array of nr_frames raw frames.
+ * @nr_frames: The number of frames.
+ * @counts: Array of nr_frames results. The unsigned digit count of
+ *          each valid frame, or -1 for each invalid frame.
+ */
+unsigned int es51984_check_frames(const struct es51984_raw_sample *raw,
+				  unsigned int nr_frames,
+				  int32_t *counts);
+
+/** es51984_decode_frames - Decode a buffer of raw frames.
+ *
+ * Validates the frames with es51984_check_frames() and fully decodes
+ * all valid frames. This doesn't need an interface. It can be used
+ * to reprocess captured data.
+ *
+ * Returns the number of successfully decoded frames.
+ *
+ * @board: The board the device is soldered onto.
+ * @raw: Array of nr_frames raw frames.
+ * @nr_frames: The number of frames.
+ * @samples: Array of nr_frames sample buffers.
+ * @errors: Array of nr_frames error codes. Zero, if samples[i] is
+ *          valid. Otherwise -EPIPE.
+ */
+unsigned int es51984_decode_frames(enum es51984_board_type board,
+				   const struct es51984_raw_sample *raw,
+				   unsigned int nr_frames,
+				   struct es51984_sample *samples,
+				   int *errors);
+
 /** es51984_discard - Discard all pending samples
  *
  * This will discard all pending samples from the input buffer.
@@ -93,13 +357,71 @@ int es51984_discard(struct es51984 *es);
 
 /** es51984_sync - Sync to the device.
  *
- * This will discard all pending samples and resynchronize
- * to the datastream. This must be called before requesting a sample.
+ * This will resynchronize to the datastream at the next valid
+ * frame boundary. Pending valid samples are not discarded.
+ * This must be called before requesting a sample.
  *
  * @es: The interface.
  */
 int es51984_sync(struct es51984 *es);
 
+/** es51984_get_fd - Get the file descriptor of the tty.
+ *
+ * It can be watched with poll() or epoll for incoming data.
+ * Use non-blocking reads on the interface after it became readable.
+ * Returns -1 for a replay interface.
+ *
+ * @es: The interface.
+ */
+int es51984_get_fd(struct es51984 *es);
+
+/** es51984_get_syscalls - Get the number of syscalls done on the tty.
+ * This counts read(), poll() and tcsetattr() calls since init.
+ *
+ * @es: The interface.
+ */
+unsigned long es51984_get_syscalls(struct es51984 *es);
+
+/** struct es51984_stats - Statistics of an interface since init.
+ * @bytes: Bytes received from the tty or the replay.
+ * @frames: Frames decoded successfully.
+ * @bad_digits: Frames with invalid digits.
+ * @bad_function: Frames with an invalid function code.
+ * @bad_range: Frames with an invalid range code.
+ * @bad_status: Frames with an invalid status code.
+ * @bad_option1: Frames with an invalid option1 code.
+ * @bad_option2: Frames with an invalid option2 code.
+ * @bad_termination: Frames without CR/LF termination.
+ * @resyncs: Re-framings after bad frames and es51984_sync() calls.
+ * @dropped_bytes: Bytes skipped while searching a frame boundary.
+ * @eagain: Reads that returned -EAGAIN.
+ * @syscalls: read(), poll() and tcsetattr() calls on the tty.
+ */
+struct es51984_stats {
+	uint64_t bytes;
+	uint64_t frames;
+	uint64_t bad_digits;
+	uint64_t bad_function;
+	uint64_t bad_range;
+	uint64_t bad_status;
+	uint64_t bad_option1;
+	uint64_t bad_option2;
+	uint64_t bad_termination;
+	uint64_t resyncs;
+	uint64_t dropped_bytes;
+	uint64_t eagain;
+	uint64_t syscalls;
+};
+
+/** es51984_get_stats - Get the statistics of an interface.
+ * The counters are maintained by the read path. They are not
+ * thread safe. Call this from the thread that reads the interface.
+ *
+ * @es: The interface.
+ * @stats: Returns the statistics.
+ */
+void es51984_get_stats(struct es51984 *es, struct es51984_stats *stats);
+
 /** es51984_init - Initialize the interface.
  * @board: The board the device is soldered onto.
  * @tty: The serial TTY device node.
@@ -107,6 +429,30 @@ int es51984_sync(struct es51984 *es);
 struct es51984 * es51984_init(enum es51984_board_type board,
 			      const char *tty);
 
+/** es51984_init_replay - Initialize an interface that replays a capture.
+ *
+ * The samples are read from a capture file written by es51984_record()
+ * instead of a tty. The board type is taken from the capture.
+ * At the end of the capture, reading a sample returns -ENODATA.
+ *
+ * @path: The capture file.
+ * @realtime: If true, deliver the samples at their recorded pace.
+ *            Otherwise deliver them as fast as possible.
+ */
+struct es51984 * es51984_init_replay(const char *path, int realtime);
+
+/** es51984_record - Record all received frames to a capture file.
+ *
+ * Every valid frame that is read from the interface is appended to
+ * the capture together with its arrival time. Bad frames are dropped.
+ * So replaying the capture yields the same sample sequence.
+ * Returns zero on success, or a negative error on failure.
+ *
+ * @es: The interface.
+ * @path: The capture file. It is overwritten.
+ */
+int es51984_record(struct es51984 *es, const char *path);
+
 /** es51984_exit - Destroy the interface. */
 void es51984_exit(struct es51984 *es);
 
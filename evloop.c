@@ -0,0 +1,206 @@
+/*
+ *   Multimeter measurement
+ *   Event loop
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "evloop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+
+#define EVLOOP_MAX_EVENTS	64
+
+struct evloop_source {
+	struct evloop_source *next;
+	int fd;			/* -1, if deleted */
+	evloop_handler_t handler;
+	void *ctx;
+};
+
+struct evloop {
+	int epfd;
+	struct evloop_source *sources;
+	bool running;
+	int ret;
+	/* Sources were deleted and must be freed. */
+	bool garbage;
+};
+
+
+static struct evloop_source * find_source(struct evloop *loop, int fd)
+{
+	struct evloop_source *src;
+
+	for (src = loop->sources; src; src = src->next) {
+		if (src->fd == fd)
+			return src;
+	}
+	return NULL;
+}
+
+int evloop_add(struct evloop *loop, int fd, uint32_t events,
+	       evloop_handler_t handler, void *ctx)
+{
+	struct evloop_source *src;
+	struct epoll_event ev;
+
+	src = calloc(1, sizeof(*src));
+	if (!src) {
+		fprintf(stderr, "Out of memory\n");
+		return -ENOMEM;
+	}
+	src->fd = fd;
+	src->handler = handler;
+	src->ctx = ctx;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = src;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		fprintf(stderr, "ERROR: Failed to add fd to epoll: %s\n",
+			strerror(errno));
+		free(src);
+		return -EIO;
+	}
+	src->next = loop->sources;
+	loop->sources = src;
+
+	return 0;
+}
+
+int evloop_mod(struct evloop *loop, int fd, uint32_t events)
+{
+	struct evloop_source *src;
+	struct epoll_event ev;
+
+	src = find_source(loop, fd);
+	if (!src)
+		return -ENOENT;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = src;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev)) {
+		fprintf(stderr, "ERROR: Failed to modify epoll fd: %s\n",
+			strerror(errno));
+		return -EIO;
+	}
+
+	return 0;
+}
+
+void evloop_del(struct evloop *loop, int fd)
+{
+	struct evloop_source *src;
+
+	src = find_source(loop, fd);
+	if (!src)
+		return;
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+	/* Events for this source might still be pending in the
+	 * current batch. Free it after the batch. */
+	src->fd = -1;
+	loop->garbage = true;
+}
+
+static void collect_garbage(struct evloop *loop)
+{
+	struct evloop_source **pp, *src;
+
+	pp = &loop->sources;
+	while ((src = *pp)) {
+		if (src->fd < 0) {
+			*pp = src->next;
+			free(src);
+		} else {
+			pp = &src->next;
+		}
+	}
+	loop->garbage = false;
+}
+
+int evloop_run(struct evloop *loop)
+{
+	struct epoll_event events[EVLOOP_MAX_EVENTS];
+	struct evloop_source *src;
+	int i, count;
+
+	loop->running = true;
+	loop->ret = 0;
+	while (loop->running) {
+		count = epoll_wait(loop->epfd, events, EVLOOP_MAX_EVENTS, -1);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ERROR: epoll_wait() failed: %s\n",
+				strerror(errno));
+			return -EIO;
+		}
+		for (i = 0; i < count; i++) {
+			src = events[i].data.ptr;
+			if (src->fd < 0)
+				continue; /* Deleted */
+			src->handler(loop, src->fd, events[i].events, src->ctx);
+		}
+		if (loop->garbage)
+			collect_garbage(loop);
+	}
+
+	return loop->ret;
+}
+
+void evloop_stop(struct evloop *loop, int ret)
+{
+	loop->running = false;
+	loop->ret = ret;
+}
+
+struct evloop * evloop_init(void)
+{
+	struct evloop *loop;
+
+	loop = calloc(1, sizeof(*loop));
+	if (!loop) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0) {
+		fprintf(stderr, "ERROR: Failed to create epoll: %s\n",
+			strerror(errno));
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+void evloop_exit(struct evloop *loop)
+{
+	struct evloop_source *src, *next;
+
+	if (!loop)
+		return;
+	for (src = loop->sources; src; src = next) {
+		next = src->next;
+		free(src);
+	}
+	close(loop->epfd);
+	free(loop);
+}
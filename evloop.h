@@ -0,0 +1,62 @@
+#ifndef EVLOOP_H_
+#define EVLOOP_H_
+
+/* Minimal epoll based event loop. */
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+
+struct evloop;
+
+/** evloop_handler_t - Event handler callback.
+ * @loop: The event loop.
+ * @fd: The file descriptor the event happened on.
+ * @events: The EPOLL... event mask.
+ * @ctx: The context pointer given to evloop_add().
+ */
+typedef void (*evloop_handler_t)(struct evloop *loop,
+				 int fd, uint32_t events,
+				 void *ctx);
+
+/** evloop_add - Watch a file descriptor.
+ * Returns zero on success, or a negative error on failure.
+ *
+ * @loop: The event loop.
+ * @fd: The file descriptor.
+ * @events: The EPOLL... event mask to watch for.
+ * @handler: The callback to run on events.
+ * @ctx: Context pointer for the callback.
+ */
+int evloop_add(struct evloop *loop, int fd, uint32_t events,
+	       evloop_handler_t handler, void *ctx);
+
+/** evloop_mod - Change the watched events of a file descriptor.
+ * Returns zero on success, or a negative error on failure.
+ */
+int evloop_mod(struct evloop *loop, int fd, uint32_t events);
+
+/** evloop_del - Stop watching a file descriptor.
+ * This may be called from within a handler.
+ */
+void evloop_del(struct evloop *loop, int fd);
+
+/** evloop_run - Run the event loop until evloop_stop() is called.
+ * Returns the value passed to evloop_stop(), or a negative error.
+ */
+int evloop_run(struct evloop *loop);
+
+/** evloop_stop - Make evloop_run() return.
+ * @loop: The event loop.
+ * @ret: The value evloop_run() returns.
+ */
+void evloop_stop(struct evloop *loop, int ret);
+
+/** evloop_init - Create an event loop. */
+struct evloop * evloop_init(void);
+
+/** evloop_exit - Destroy an event loop. */
+void evloop_exit(struct evloop *loop);
+
+
+#endif /* EVLOOP_H_ */
@@ -0,0 +1,88 @@
+/*
+ *   Multimeter measurement
+ *   Log-linear latency histogram
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "histogram.h"
+
+#include <string.h>
+#include <math.h>
+
+
+/* Get the bucket index of a value. */
+static unsigned int histogram_index(uint64_t value)
+{
+	unsigned int msb, shift;
+
+	if (value < HISTOGRAM_SUB)
+		return (unsigned int)value;
+	if (value >> HISTOGRAM_MAX_BITS)
+		value = ((uint64_t)1 << HISTOGRAM_MAX_BITS) - 1;
+	msb = 63u - (unsigned int)__builtin_clzll(value);
+	/* value >> shift is in [HALF, SUB). */
+	shift = msb - (HISTOGRAM_SUB_BITS - 1);
+
+	return HISTOGRAM_SUB + (shift - 1) * HISTOGRAM_HALF +
+	       (unsigned int)(value >> shift) - HISTOGRAM_HALF;
+}
+
+/* Get the largest value that maps to a bucket. */
+static uint64_t histogram_upper(unsigned int index)
+{
+	unsigned int shift, top;
+
+	if (index < HISTOGRAM_SUB)
+		return index;
+	shift = (index - HISTOGRAM_SUB) / HISTOGRAM_HALF + 1;
+	top = (index - HISTOGRAM_SUB) % HISTOGRAM_HALF + HISTOGRAM_HALF;
+
+	return (((uint64_t)top + 1) << shift) - 1;
+}
+
+void histogram_reset(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void histogram_record(struct histogram *h, int64_t value)
+{
+	uint64_t v = value > 0 ? (uint64_t)value : 0;
+
+	h->buckets[histogram_index(v)]++;
+	h->count++;
+	if (v > h->max)
+		h->max = v;
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double percentile)
+{
+	uint64_t rank, seen = 0, upper;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+	rank = (uint64_t)ceil(percentile / 100.0 * (double)h->count);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank) {
+			upper = histogram_upper(i);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+
+	return h->max;
+}
@@ -0,0 +1,51 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+/* Log-linear latency histogram. */
+
+#include <stdint.h>
+
+
+/* Values below 2^HISTOGRAM_SUB_BITS are counted exactly. Above that,
+ * every power of two is split into 2^(HISTOGRAM_SUB_BITS-1) linear
+ * buckets. So the relative error is below 1/64. */
+#define HISTOGRAM_SUB_BITS	7
+#define HISTOGRAM_SUB		(1u << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF		(HISTOGRAM_SUB / 2)
+/* The largest tracked value is 2^HISTOGRAM_MAX_BITS - 1.
+ * In nanoseconds that is about 18 minutes. Larger values are clamped. */
+#define HISTOGRAM_MAX_BITS	40
+#define HISTOGRAM_BUCKETS	(HISTOGRAM_SUB + \
+				 (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS) * HISTOGRAM_HALF)
+
+/** struct histogram - A fixed size histogram of non-negative values.
+ * @count: The number of recorded values.
+ * @max: The largest recorded value. Not clamped.
+ * @buckets: The number of values per bucket.
+ */
+struct histogram {
+	uint64_t count;
+	uint64_t max;
+	uint32_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/** histogram_reset - Clear a histogram. */
+void histogram_reset(struct histogram *h);
+
+/** histogram_record - Record a value.
+ * Negative values are recorded as zero.
+ */
+void histogram_record(struct histogram *h, int64_t value);
+
+/** histogram_percentile - Get a percentile of the recorded values.
+ * Returns the upper bound of the bucket that holds the percentile,
+ * but never more than the largest recorded value.
+ * Returns zero, if the histogram is empty.
+ *
+ * @h: The histogram.
+ * @percentile: The percentile. 0.0 to 100.0.
+ */
+uint64_t histogram_percentile(const struct histogram *h, double percentile);
+
+
+#endif /* HISTOGRAM_H_ */
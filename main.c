@@ -15,6 +15,16 @@
  */
 
 #include "es51984.h"
+#include "output.h"
+#include "decode.h"
+#include "evloop.h"
+#include "ring.h"
+#include "aggregate.h"
+#include "deadband.h"
+#include "shm.h"
+#include "server.h"
+#include "histogram.h"
+#include "devspec.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,128 +34,767 @@
 #include <stdbool.h>
 #include <getopt.h>
 #include <time.h>
-#include <sys/time.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 
 
+enum replay_mode {
+	REPLAY_OFF,		/* Read from a tty */
+	REPLAY_FAST,		/* Replay a capture as fast as possible */
+	REPLAY_REALTIME,	/* Replay a capture at its recorded pace */
+};
+
 static struct {
-	const char *dev;
+	char **devs;
+	unsigned int nr_devs;
 	bool csv;
-	bool timestamp;
+	bool binary;
+	enum output_timestamp timestamp;
 	double sleep;
+	double aggregate;
+	bool deadband;
+	double deadband_abs;
+	double deadband_rel;
+	double heartbeat;
+	bool debug;
+	const char *record;
+	enum replay_mode replay;
+	bool decode;
+	unsigned int jobs;
+	bool pipeline;
+	const char *shm;
+	const char *listen;
+	enum output_flush_policy flush;
+	int flush_ms;
+	bool stats;
+	double stats_interval;
+	bool latency;
 } cmdline;
 
+static unsigned int nr_active_meters;
+static struct output_writer out;
+static struct shm_pub *shm_pub;
+static struct server *server;
 
-static int timeval_msec_diff(const struct timeval *a, const struct timeval *b)
-{
-	int64_t usec_a, usec_b, usec_diff;
 
-	usec_a = (int64_t)a->tv_sec * 1000000;
-	usec_a += (int64_t)a->tv_usec;
+struct meter {
+	const char *dev;
+	enum es51984_board_type board;
+	struct es51984 *es;
+	const char *tag;	/* Output tag, or NULL */
+	unsigned int index;	/* Position on the command line */
+
+	/* --sleep state */
+	int64_t prev_ns;	/* CLOCK_MONOTONIC of the last print */
+	bool firstrun;
 
-	usec_b = (int64_t)b->tv_sec * 1000000;
-	usec_b += (int64_t)b->tv_usec;
+	/* --aggregate state */
+	struct aggregate agg;
 
-	usec_diff = usec_a - usec_b;
+	/* --deadband state */
+	struct deadband db;
+};
 
-	return usec_diff / 1000;
-}
+/* Number of samples fetched per es51984_get_samples() call. */
+#define METER_BATCH	64
+
+/* --stats state */
+static struct {
+	struct meter *meters;
+	unsigned int nr_meters;
+	int sig_fd;		/* signalfd for SIGUSR1, SIGINT and SIGTERM */
+	int timer_fd;		/* Periodic timerfd, or -1 */
+} stats = {
+	.sig_fd = -1,
+	.timer_fd = -1,
+};
+
+/* --latency histograms. Each one is only touched by one thread. */
+static struct {
+	struct histogram frame;		/* First byte to frame complete */
+	struct histogram decode;	/* Frame complete to decoded */
+	struct histogram write;		/* Decoded to written */
+} latency;
+
+/* The --aggregate windows of quiet meters are closed by a timer.
+ * It fires this many times per window. */
+#define WINDOW_TICKS	4
+
+/* --aggregate timer state */
+static struct {
+	struct meter *meters;
+	unsigned int nr_meters;
+} windows;
+
+/* Number of samples queued between acquisition and output (--pipeline). */
+#define PIPELINE_ENTRIES	4096
+
+struct pipeline_entry {
+	struct meter *meter;
+	struct es51984_sample sample;
+	int64_t decoded_ns;
+	/* No sample. Close the --aggregate window of the meter,
+	 * if it is due at sample.mono_ns. */
+	bool window_tick;
+};
 
-static int dump_es51984(enum es51984_board_type board,
-			const char *dev,
-			bool csv,
-			bool timestamp,
-			double sleep)
+static struct {
+	struct ring ring;
+	struct meter *meters;
+	unsigned int nr_meters;
+	unsigned long dropped;	/* Samples lost to a full ring */
+	int ret;		/* acquire() result */
+} pipeline;
+
+static int meter_open(struct meter *m)
 {
-	struct es51984 *es = NULL;
 	struct es51984_sample sample;
-	int ret = -ENODEV;
 	int err;
-	const char *units;
-	double value;
-	time_t t;
-	struct tm tm;
-	char tbuf[256];
-	struct timeval tv, prev_tv = { 0 };
-	int sleep_ms;
-	bool firstrun = true;
-
-	sleep_ms = (int)round(sleep * 1000.0);
-
-	es = es51984_init(board, dev);
-	if (!es)
-		goto out;
-	err = es51984_sync(es);
-	if (err) {
-		fprintf(stderr, "Failed to sync to data stream.\n");
-		goto out;
+
+	m->firstrun = true;
+	m->prev_ns = 0;
+	aggregate_reset(&m->agg);
+	deadband_init(&m->db, cmdline.deadband_abs, cmdline.deadband_rel,
+		      (int64_t)round(cmdline.heartbeat * 1000.0) * 1000000);
+
+	if (cmdline.replay == REPLAY_OFF)
+		m->es = es51984_init(m->board, m->dev);
+	else
+		m->es = es51984_init_replay(m->dev, cmdline.replay == REPLAY_REALTIME);
+	if (!m->es)
+		return -ENODEV;
+	if (cmdline.record) {
+		err = es51984_record(m->es, cmdline.record);
+		if (err)
+			return err;
 	}
-	/* Discard first sample */
-	err = es51984_get_sample(es, &sample, 1, 0);
+	err = es51984_sync(m->es);
 	if (err) {
-		fprintf(stderr, "ERROR: Failed to read sample.\n");
-		goto out;
+		fprintf(stderr, "%s: Failed to sync to data stream.\n", m->dev);
+		return err;
+	}
+	if (cmdline.replay == REPLAY_OFF) {
+		/* Discard first sample */
+		err = es51984_get_sample(m->es, &sample, 1, 0);
+		if (err && err != -EBADMSG) {
+			fprintf(stderr, "%s: ERROR: Failed to read sample.\n", m->dev);
+			return err;
+		}
 	}
 
-	if (gettimeofday(&prev_tv, NULL)) {
-		fprintf(stderr, "ERROR: gettimeofday() failed.\n");
-		goto out;
+	return 0;
+}
+
+static int64_t clock_mono_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Write formatted output to stdout and to the --listen clients.
+ * decoded_ns is the time the sample was decoded, or 0. */
+static void emit(const void *data, size_t len, int64_t decoded_ns)
+{
+	if (decoded_ns)
+		output_write_stamped(&out, data, len, decoded_ns);
+	else
+		output_write(&out, data, len);
+	if (server)
+		server_broadcast(server, data, len);
+}
+
+/* Print the statistics of the current --aggregate window and start
+ * a new one. */
+static void meter_flush_window(struct meter *m)
+{
+	char line[256];
+	int len;
+
+	if (!m->agg.active)
+		return;
+	len = output_format_aggregate(line, sizeof(line), &m->agg,
+				      m->agg.mode.realtime_ns, cmdline.csv,
+				      cmdline.timestamp, m->tag);
+	if (len > 0 && (size_t)len < sizeof(line))
+		emit(line, (size_t)len, 0);
+	aggregate_reset(&m->agg);
+}
+
+static int64_t aggregate_window_ns(void)
+{
+	return (int64_t)round(cmdline.aggregate * 1000.0) * 1000000;
+}
+
+/* Close the --aggregate window, if it is due at now_ns.
+ * So a meter that went quiet still gets its last window printed. */
+static void meter_close_window(struct meter *m, int64_t now_ns)
+{
+	if (m->agg.active &&
+	    now_ns - m->agg.mode.mono_ns >= aggregate_window_ns())
+		meter_flush_window(m);
+}
+
+static void meter_aggregate(struct meter *m, const struct es51984_sample *sample)
+{
+	if (m->agg.active && !aggregate_fits(&m->agg, sample))
+		meter_flush_window(m);
+	meter_close_window(m, sample->mono_ns);
+	aggregate_add(&m->agg, sample);
+}
+
+static void meter_output(struct meter *m, const struct es51984_sample *sample,
+			 int64_t decoded_ns)
+{
+	struct mmmeas_bin_record rec;
+	char line[256];
+	int64_t sleep_ns;
+	int len;
+
+	if (cmdline.aggregate > 0.0) {
+		meter_aggregate(m, sample);
+		return;
 	}
-	while (1) {
-		err = es51984_get_sample(es, &sample, 1, 0);
-		if (err) {
-			fprintf(stderr, "ERROR: Failed to read sample.\n");
-			continue;
-		}
+	if (cmdline.deadband && !deadband_pass(&m->db, sample))
+		return;
 
-		t = time(NULL);
-		if (t == ((time_t)-1)) {
-			fprintf(stderr, "ERROR: Failed to get time.\n");
-			continue;
+	/* Rate limit by the arrival times of the samples. */
+	sleep_ns = (int64_t)round(cmdline.sleep * 1000.0) * 1000000;
+	if (sleep_ns > 0) {
+		if ((sample->mono_ns - m->prev_ns < sleep_ns) && !m->firstrun)
+			return;
+		m->prev_ns = sample->mono_ns;
+	}
+
+	if (cmdline.binary) {
+		output_binary_record(&rec, sample, sample->realtime_ns, m->index);
+		emit(&rec, sizeof(rec), decoded_ns);
+		m->firstrun = false;
+		return;
+	}
+
+	len = output_format_sample(line, sizeof(line), sample,
+				   sample->realtime_ns, cmdline.csv,
+				   cmdline.timestamp, m->tag);
+	if (len < 0 || (size_t)len >= sizeof(line))
+		return;
+	if (cmdline.debug)
+		fflush(stdout); /* Keep the order with the debug dumps. */
+	emit(line, (size_t)len, decoded_ns);
+	m->firstrun = false;
+}
+
+/* Hand a freshly read sample over to the output.
+ * decoded_ns is the time the sample was decoded, or 0. */
+static void meter_emit(struct meter *m, const struct es51984_sample *sample,
+		       int64_t decoded_ns)
+{
+	struct pipeline_entry *entry;
+
+	/* Publish every sample right away, whatever the output does. */
+	if (shm_pub)
+		shm_pub_publish(shm_pub, m->index, sample);
+
+	if (!cmdline.pipeline) {
+		meter_output(m, sample, decoded_ns);
+		return;
+	}
+
+	entry = ring_push_slot(&pipeline.ring);
+	if (!entry && cmdline.replay == REPLAY_FAST) {
+		/* Nothing is lost by waiting for the output here. */
+		ring_wait_space(&pipeline.ring);
+		entry = ring_push_slot(&pipeline.ring);
+	}
+	if (!entry) {
+		/* Never block acquisition on the output. */
+		pipeline.dropped++;
+		return;
+	}
+	entry->meter = m;
+	entry->sample = *sample;
+	entry->decoded_ns = decoded_ns;
+	entry->window_tick = false;
+	ring_push_commit(&pipeline.ring);
+}
+
+/* Read and print all samples that are available from a meter.
+ * Returns 0 or -EAGAIN, if all available samples were processed.
+ * Returns -ENODATA at the end of a replay. */
+static int meter_read(struct meter *m, int timeout_ms)
+{
+	struct es51984_sample samples[METER_BATCH];
+	int errors[METER_BATCH];
+	int64_t decoded_ns = 0;
+	int i, count;
+
+	do {
+		if (cmdline.debug) {
+			/* The debug dump is only done per sample. */
+			count = es51984_get_sample_timeout(m->es, &samples[0],
+							   timeout_ms, 1);
+			errors[0] = count;
+			if (count == 0 || count == -EBADMSG)
+				count = 1;
+		} else {
+			count = es51984_get_samples(m->es, samples, errors,
+						    METER_BATCH, timeout_ms);
+		}
+		if (count < 0) {
+			if (count != -EAGAIN && count != -ENODATA)
+				fprintf(stderr, "%s: ERROR: Failed to read sample.\n", m->dev);
+			return count;
 		}
-		if (sleep_ms > 0) {
-			if (gettimeofday(&tv, NULL)) {
-				fprintf(stderr, "ERROR: gettimeofday() failed.\n");
+		if (cmdline.latency)
+			decoded_ns = clock_mono_nsec();
+		for (i = 0; i < count; i++) {
+			if (errors[i] == -EBADMSG) {
+				/* The library dropped the bad frame and
+				 * re-frames by itself. */
 				continue;
 			}
-			if ((timeval_msec_diff(&tv, &prev_tv) < sleep_ms) && !firstrun)
+			if (errors[i]) {
+				fprintf(stderr, "%s: ERROR: Failed to read sample.\n", m->dev);
 				continue;
-			prev_tv = tv;
+			}
+			if (cmdline.latency) {
+				histogram_record(&latency.frame,
+						 samples[i].mono_ns - samples[i].first_mono_ns);
+				histogram_record(&latency.decode,
+						 decoded_ns - samples[i].mono_ns);
+			}
+			meter_emit(m, &samples[i], decoded_ns);
 		}
+		/* A full batch means that more samples might be buffered. */
+	} while (cmdline.debug || count == METER_BATCH);
 
-		localtime_r(&t, &tm);
-		strftime(tbuf, sizeof(tbuf), "%F;%T", &tm);
+	return 0;
+}
+
+/* Print the interface statistics of a meter to stderr. */
+static void stats_print_meter(const struct meter *m)
+{
+	struct es51984_stats st;
+
+	if (!m->es)
+		return;
+	es51984_get_stats(m->es, &st);
+	fprintf(stderr, "%s: stats: bytes=%llu frames=%llu "
+		"bad_digits=%llu bad_function=%llu bad_range=%llu "
+		"bad_status=%llu bad_option1=%llu bad_option2=%llu "
+		"bad_termination=%llu resyncs=%llu dropped_bytes=%llu "
+		"eagain=%llu syscalls=%llu\n",
+		m->dev,
+		(unsigned long long)st.bytes,
+		(unsigned long long)st.frames,
+		(unsigned long long)st.bad_digits,
+		(unsigned long long)st.bad_function,
+		(unsigned long long)st.bad_range,
+		(unsigned long long)st.bad_status,
+		(unsigned long long)st.bad_option1,
+		(unsigned long long)st.bad_option2,
+		(unsigned long long)st.bad_termination,
+		(unsigned long long)st.resyncs,
+		(unsigned long long)st.dropped_bytes,
+		(unsigned long long)st.eagain,
+		(unsigned long long)st.syscalls);
+}
+
+static void stats_print(void)
+{
+	unsigned int i;
 
-		if (sample.function == ES51984_FUNC_TEMP)
-			units = sample.degree ? "*C" : "F";
+	for (i = 0; i < stats.nr_meters; i++)
+		stats_print_meter(&stats.meters[i]);
+}
+
+/* Handle pending --stats signals and timer expirations.
+ * Returns true, if SIGINT or SIGTERM asks to terminate. */
+static bool stats_poll(void)
+{
+	struct signalfd_siginfo si;
+	uint64_t expirations;
+	bool quit = false;
+
+	while (read(stats.sig_fd, &si, sizeof(si)) == sizeof(si)) {
+		if (si.ssi_signo == SIGUSR1) {
+			if (cmdline.stats)
+				stats_print();
+		}
 		else
-			units = es51984_get_units(&sample);
-		value = sample.overflow ? 0.0 : sample.value;
-		if (csv) {
-			printf("%s%s%lf\n",
-			       timestamp ? tbuf : "",
-			       timestamp ? ";" : "",
-			       value);
-		} else {
-			printf("%s%s%s%.3lf %s%s  (%s, %s, %s)%s\n",
-			       timestamp ? "[" : "",
-			       timestamp ? tbuf : "",
-			       timestamp ? "] " : "",
-			       value,
-			       sample.overflow ? "OVERFLOW " : "",
-			       units,
-			       sample.dc_mode ? "DC" : "AC",
-			       sample.auto_mode ? "auto" : "man",
-			       sample.hold ? "hold" : "no-hold",
-			       sample.batt_low ? " BATTERY LOW" : "");
+			quit = true;
+	}
+	if (stats.timer_fd >= 0 &&
+	    read(stats.timer_fd, &expirations, sizeof(expirations)) > 0)
+		stats_print();
+
+	return quit;
+}
+
+static void stats_event(struct evloop *loop, int fd, uint32_t events, void *ctx)
+{
+	if (stats_poll())
+		evloop_stop(loop, 0);
+}
+
+static void meter_event(struct evloop *loop, int fd, uint32_t events, void *ctx)
+{
+	struct meter *m = ctx;
+	int err;
+
+	err = meter_read(m, 0);
+	if ((err == 0 || err == -EAGAIN || err == -ETIME) &&
+	    !(events & (EPOLLHUP | EPOLLERR)))
+		return;
+
+	fprintf(stderr, "%s: Device removed.\n", m->dev);
+	if (cmdline.stats)
+		stats_print_meter(m);
+	evloop_del(loop, fd);
+	es51984_exit(m->es);
+	m->es = NULL;
+	if (--nr_active_meters == 0)
+		evloop_stop(loop, -EIO);
+}
+
+static void flush_timer_event(struct evloop *loop, int fd, uint32_t events, void *ctx)
+{
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0)
+		return;
+	output_flush(&out);
+}
+
+static void window_timer_event(struct evloop *loop, int fd, uint32_t events, void *ctx)
+{
+	struct pipeline_entry *entry;
+	uint64_t expirations;
+	int64_t now_ns;
+	unsigned int i;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0)
+		return;
+	now_ns = clock_mono_nsec();
+	for (i = 0; i < windows.nr_meters; i++) {
+		if (!cmdline.pipeline) {
+			meter_close_window(&windows.meters[i], now_ns);
+			continue;
 		}
-		fflush(stdout);
-		firstrun = false;
+		/* The windows belong to the output thread. Ask it to close
+		 * them. If the ring is full, the next tick does it. */
+		entry = ring_push_slot(&pipeline.ring);
+		if (!entry)
+			break;
+		entry->meter = &windows.meters[i];
+		entry->sample.mono_ns = now_ns;
+		entry->window_tick = true;
+		ring_push_commit(&pipeline.ring);
 	}
+}
 
-	ret = 0;
+/* Create a timerfd that fires every interval_ms. */
+static int periodic_timer_create(int interval_ms)
+{
+	struct itimerspec its;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Failed to create timerfd.\n");
+		return -EIO;
+	}
+	its.it_interval.tv_sec = interval_ms / 1000;
+	its.it_interval.tv_nsec = (long)(interval_ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL)) {
+		fprintf(stderr, "ERROR: Failed to arm timerfd.\n");
+		close(fd);
+		return -EIO;
+	}
+
+	return fd;
+}
+
+/* Read all meters until they are gone or the replay ended. */
+static int acquire(struct meter *meters, unsigned int nr_meters)
+{
+	struct mmmeas_bin_header bin_hdr;
+	struct evloop *loop;
+	unsigned int i;
+	int timer_fd = -1, window_fd = -1, tick_ms;
+	int ret = -ENODEV;
+	int err;
+
+	if (cmdline.replay != REPLAY_OFF) {
+		/* A replay can't be polled. Just read it. */
+		do {
+			err = meter_read(&meters[0], -1);
+			if (cmdline.stats && stats_poll())
+				return 0;
+		} while (err == 0 || err == -EAGAIN || err == -ETIME);
+		return (err == -ENODATA) ? 0 : err;
+	}
+
+	/* Serve all meters from one event loop. */
+	loop = evloop_init();
+	if (!loop)
+		return -ENOMEM;
+	for (i = 0; i < nr_meters; i++) {
+		err = evloop_add(loop, es51984_get_fd(meters[i].es), EPOLLIN,
+				 meter_event, &meters[i]);
+		if (err)
+			goto out;
+	}
+	if (cmdline.listen) {
+		output_binary_header(&bin_hdr);
+		server = server_init(loop, cmdline.listen,
+				     cmdline.binary ? &bin_hdr : NULL,
+				     sizeof(bin_hdr));
+		if (!server) {
+			ret = -EIO;
+			goto out;
+		}
+	}
+	if (!cmdline.pipeline && cmdline.flush == OUTPUT_FLUSH_INTERVAL) {
+		/* Flush the output, even if no new samples arrive. */
+		timer_fd = periodic_timer_create(cmdline.flush_ms);
+		if (timer_fd < 0) {
+			ret = timer_fd;
+			goto out;
+		}
+		err = evloop_add(loop, timer_fd, EPOLLIN, flush_timer_event, NULL);
+		if (err) {
+			ret = err;
+			goto out;
+		}
+	}
+	if (cmdline.aggregate > 0.0) {
+		/* Close the windows, even if no new samples arrive. */
+		windows.meters = meters;
+		windows.nr_meters = nr_meters;
+		tick_ms = (int)(aggregate_window_ns() / WINDOW_TICKS / 1000000);
+		window_fd = periodic_timer_create(tick_ms > 0 ? tick_ms : 1);
+		if (window_fd < 0) {
+			ret = window_fd;
+			goto out;
+		}
+		err = evloop_add(loop, window_fd, EPOLLIN, window_timer_event, NULL);
+		if (err) {
+			ret = err;
+			goto out;
+		}
+	}
+	if (cmdline.stats || cmdline.latency) {
+		err = evloop_add(loop, stats.sig_fd, EPOLLIN, stats_event, NULL);
+		if (!err && stats.timer_fd >= 0)
+			err = evloop_add(loop, stats.timer_fd, EPOLLIN, stats_event, NULL);
+		if (err) {
+			ret = err;
+			goto out;
+		}
+	}
+	nr_active_meters = nr_meters;
+	ret = evloop_run(loop);
 out:
-	es51984_exit(es);
+	server_exit(server);
+	server = NULL;
+	evloop_exit(loop);
+	if (timer_fd >= 0)
+		close(timer_fd);
+	if (window_fd >= 0)
+		close(window_fd);
+
+	return ret;
+}
+
+static void * acquire_thread(void *arg)
+{
+	pipeline.ret = acquire(pipeline.meters, pipeline.nr_meters);
+	ring_close(&pipeline.ring);
+
+	return NULL;
+}
+
+/* Acquire in a separate thread and print from this one. */
+static int run_pipeline(struct meter *meters, unsigned int nr_meters)
+{
+	struct pipeline_entry *entry;
+	pthread_t thread;
+	int err;
+
+	err = ring_init(&pipeline.ring, PIPELINE_ENTRIES, sizeof(*entry));
+	if (err)
+		return err;
+	pipeline.meters = meters;
+	pipeline.nr_meters = nr_meters;
+	pipeline.dropped = 0;
+	pipeline.ret = 0;
+
+	if (pthread_create(&thread, NULL, acquire_thread, NULL)) {
+		fprintf(stderr, "ERROR: Failed to create acquisition thread.\n");
+		ring_exit(&pipeline.ring);
+		return -ENOMEM;
+	}
+	while (ring_wait_data(&pipeline.ring)) {
+		while ((entry = ring_pop_slot(&pipeline.ring))) {
+			if (entry->window_tick)
+				meter_close_window(entry->meter, entry->sample.mono_ns);
+			else
+				meter_output(entry->meter, &entry->sample,
+					     entry->decoded_ns);
+			ring_pop_commit(&pipeline.ring);
+		}
+		/* The ring ran empty. Don't hold back output while idle. */
+		if (cmdline.flush != OUTPUT_FLUSH_FULL)
+			output_flush(&out);
+	}
+	pthread_join(thread, NULL);
+	ring_exit(&pipeline.ring);
+
+	if (pipeline.dropped) {
+		fprintf(stderr, "WARNING: %lu samples dropped due to slow output.\n",
+			pipeline.dropped);
+	}
+
+	return pipeline.ret;
+}
+
+/* Set up the --stats signal and timer file descriptors.
+ * The signals are blocked before any thread is created,
+ * so that they are only delivered through the signalfd. */
+static int stats_init(struct meter *meters, unsigned int nr_meters)
+{
+	sigset_t set;
+
+	stats.meters = meters;
+	stats.nr_meters = nr_meters;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	if (pthread_sigmask(SIG_BLOCK, &set, NULL)) {
+		fprintf(stderr, "ERROR: Failed to block signals.\n");
+		return -EIO;
+	}
+	stats.sig_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (stats.sig_fd < 0) {
+		fprintf(stderr, "ERROR: Failed to create signalfd.\n");
+		return -EIO;
+	}
+	if (cmdline.stats_interval > 0.0) {
+		stats.timer_fd = periodic_timer_create(
+			(int)round(cmdline.stats_interval * 1000.0));
+		if (stats.timer_fd < 0)
+			return stats.timer_fd;
+	}
+
+	return 0;
+}
+
+static void stats_exit(void)
+{
+	if (stats.sig_fd >= 0)
+		close(stats.sig_fd);
+	if (stats.timer_fd >= 0)
+		close(stats.timer_fd);
+	stats.sig_fd = -1;
+	stats.timer_fd = -1;
+}
+
+static void latency_print_one(const char *name, const struct histogram *h)
+{
+	fprintf(stderr, "latency %-24s n=%llu p50=%.1fus p99=%.1fus "
+		"p99.9=%.1fus max=%.1fus\n",
+		name, (unsigned long long)h->count,
+		(double)histogram_percentile(h, 50.0) / 1000.0,
+		(double)histogram_percentile(h, 99.0) / 1000.0,
+		(double)histogram_percentile(h, 99.9) / 1000.0,
+		(double)h->max / 1000.0);
+}
+
+/* Print the --latency histograms to stderr. */
+static void latency_print(void)
+{
+	latency_print_one("first byte to frame:", &latency.frame);
+	latency_print_one("frame to decoded:", &latency.decode);
+	latency_print_one("decoded to written:", &latency.write);
+}
+
+static int dump_es51984(struct meter *meters, unsigned int nr_meters)
+{
+	struct mmmeas_bin_header bin_hdr;
+	const char **names;
+	unsigned int i;
+	int ret, err;
+
+	if (cmdline.shm) {
+		names = calloc(nr_meters, sizeof(*names));
+		if (!names) {
+			fprintf(stderr, "ERROR: Out of memory\n");
+			return -ENOMEM;
+		}
+		for (i = 0; i < nr_meters; i++)
+			names[i] = meters[i].dev;
+		shm_pub = shm_pub_init(cmdline.shm, names, nr_meters);
+		free(names);
+		if (!shm_pub)
+			return -EIO;
+	}
+
+	output_writer_init(&out, STDOUT_FILENO, cmdline.flush, cmdline.flush_ms);
+	if (cmdline.latency) {
+		histogram_reset(&latency.frame);
+		histogram_reset(&latency.decode);
+		histogram_reset(&latency.write);
+		output_writer_latency(&out, &latency.write);
+	}
+	if (cmdline.binary) {
+		output_binary_header(&bin_hdr);
+		output_write(&out, (const char *)&bin_hdr, sizeof(bin_hdr));
+	}
+	for (i = 0; i < nr_meters; i++) {
+		if (nr_meters > 1)
+			meters[i].tag = meters[i].dev;
+		ret = meter_open(&meters[i]);
+		if (ret)
+			goto out;
+	}
+	if (cmdline.stats || cmdline.latency) {
+		/* Exit cleanly on SIGINT and SIGTERM to print the reports.
+		 * The signals are only routed to the signalfd now, because
+		 * nothing reads it while the meters are opened. Until then
+		 * SIGINT and SIGTERM just terminate. */
+		ret = stats_init(meters, nr_meters);
+		if (ret)
+			goto out;
+	}
+
+	if (cmdline.pipeline)
+		ret = run_pipeline(meters, nr_meters);
+	else
+		ret = acquire(meters, nr_meters);
+out:
+	for (i = 0; i < nr_meters; i++) {
+		meter_flush_window(&meters[i]);
+		if (cmdline.stats)
+			stats_print_meter(&meters[i]);
+		es51984_exit(meters[i].es);
+	}
+	stats_exit();
+	err = output_writer_exit(&out);
+	if (err && !ret)
+		ret = err;
+	if (cmdline.latency)
+		latency_print();
+	shm_pub_exit(shm_pub);
+	shm_pub = NULL;
 
 	return ret;
 }
@@ -153,14 +802,64 @@ out:
 static void usage(void)
 {
 	printf("Multimeter measurement\n\n"
-	       "  Usage: mmmeas [OPTIONS] DEVICE\n"
+	       "  Usage: mmmeas [OPTIONS] DEVICE[:BOARD] [DEVICE[:BOARD] ...]\n"
 	       "\n"
-	       "  DEVICE is the serial device node.\n"
+	       "  DEVICE is the serial device node or a capture file (--replay).\n"
+	       "  BOARD is the board type: 35xpa (default) or unknown.\n"
+	       "  DEVICE may contain ':'. Only a BOARD name after the last ':'\n"
+	       "  is split off.\n"
+	       "  All devices are served by one thread. The output of multiple\n"
+	       "  devices is prefixed with the DEVICE name.\n"
 	       "\n"
 	       "Options:\n"
 	       "  -c|--csv             Use CSV output\n"
+	       "  -B|--binary          Write packed binary records as described\n"
+	       "                       in mmmeas_binary.h\n"
 	       "  -t|--timestamp       Print time stamps in output\n"
+	       "  -T|--hires           Print time stamps with microsecond resolution\n"
 	       "  -s|--sleep SECONDS   Sleep and discard values between prints\n"
+	       "  -a|--aggregate SECONDS\n"
+	       "                       Print min/max/mean/stddev of all values in\n"
+	       "                       windows of SECONDS. A change of the function,\n"
+	       "                       range or AC/DC mode starts a new window.\n"
+	       "                       A window of a quiet meter is closed by a timer\n"
+	       "  -b|--deadband DELTA  Only print values that differ from the last\n"
+	       "                       printed one by more than DELTA, or by more than\n"
+	       "                       DELTA percent (e.g. 0.5%%), or that have any\n"
+	       "                       flag changed. 0 prints every change.\n"
+	       "                       Give it twice to set both. A value must then\n"
+	       "                       differ by more than both, so the wider applies\n"
+	       "  -H|--heartbeat SECONDS\n"
+	       "                       Print a value at least every SECONDS, even if\n"
+	       "                       it did not change. Implies --deadband 0\n"
+	       "  -d|--debug           Dump raw samples and syscall counts\n"
+	       "  -r|--record FILE     Record the raw data stream to a capture FILE\n"
+	       "  -R|--replay          DEVICE is a capture FILE. Replay it fast\n"
+	       "  -L|--replay-live     DEVICE is a capture FILE. Replay it at its pace\n"
+	       "  -D|--decode          DEVICE is a capture FILE or raw stream dump.\n"
+	       "                       Decode it offline with multiple threads.\n"
+	       "                       BOARD applies to raw stream dumps. A capture\n"
+	       "                       carries its board type\n"
+	       "  -j|--jobs N          Number of --decode threads. Default: all CPUs\n"
+	       "  -P|--pipeline        Read the devices in a separate thread, so that\n"
+	       "                       slow output never stalls reading\n"
+	       "  -S|--shm NAME        Publish the latest sample of each DEVICE in\n"
+	       "                       the POSIX shared memory object NAME.\n"
+	       "                       See mmmeas_shm.h\n"
+	       "  -l|--listen PATH     Serve the output to any number of clients on\n"
+	       "                       the Unix socket PATH. Slow clients lose\n"
+	       "                       their oldest data, but never stall reading\n"
+	       "  -F|--flush MODE      Output flush MODE: 'line', 'full' (when the\n"
+	       "                       buffer is full) or a period in milliseconds.\n"
+	       "                       Default: 'line'. A period or 'full' is much\n"
+	       "                       faster, if the reader needs no line latency\n"
+	       "  -e|--latency         Measure the latency from the arrival of a frame\n"
+	       "                       to the write of its output. Print p50/p99/\n"
+	       "                       p99.9/max of each stage to stderr at exit.\n"
+	       "                       SIGINT and SIGTERM exit cleanly\n"
+	       "  -Y|--stats SECONDS   Print the interface statistics to stderr every\n"
+	       "                       SECONDS, on SIGUSR1 and at exit. SIGINT and\n"
+	       "                       SIGTERM exit cleanly. 0 disables the period\n"
 	       "  -h|--help            Print this help text\n"
 	);
 }
@@ -169,20 +868,59 @@ static int parse_args(int argc, char **argv)
 {
 	static const struct option long_options[] = {
 		{ "csv", no_argument, NULL, 'c', },
+		{ "binary", no_argument, NULL, 'B', },
 		{ "timestamp", no_argument, NULL, 't', },
+		{ "hires", no_argument, NULL, 'T', },
 		{ "sleep", required_argument, NULL, 's', },
+		{ "aggregate", required_argument, NULL, 'a', },
+		{ "deadband", required_argument, NULL, 'b', },
+		{ "heartbeat", required_argument, NULL, 'H', },
+		{ "debug", no_argument, NULL, 'd', },
+		{ "record", required_argument, NULL, 'r', },
+		{ "replay", no_argument, NULL, 'R', },
+		{ "replay-live", no_argument, NULL, 'L', },
+		{ "decode", no_argument, NULL, 'D', },
+		{ "jobs", required_argument, NULL, 'j', },
+		{ "pipeline", no_argument, NULL, 'P', },
+		{ "flush", required_argument, NULL, 'F', },
+		{ "shm", required_argument, NULL, 'S', },
+		{ "listen", required_argument, NULL, 'l', },
+		{ "stats", required_argument, NULL, 'Y', },
+		{ "latency", no_argument, NULL, 'e', },
 		{ "help", no_argument, NULL, 'h', },
 		{ NULL, },
 	};
+	double delta;
+	char unit;
 	int c, idx;
 
-	cmdline.dev = NULL;
+	cmdline.devs = NULL;
+	cmdline.nr_devs = 0;
 	cmdline.csv = false;
-	cmdline.timestamp = false;
+	cmdline.binary = false;
+	cmdline.timestamp = OUTPUT_TS_NONE;
 	cmdline.sleep = 0.0;
+	cmdline.aggregate = 0.0;
+	cmdline.deadband = false;
+	cmdline.deadband_abs = 0.0;
+	cmdline.deadband_rel = 0.0;
+	cmdline.heartbeat = 0.0;
+	cmdline.debug = false;
+	cmdline.record = NULL;
+	cmdline.replay = REPLAY_OFF;
+	cmdline.decode = false;
+	cmdline.jobs = 0;
+	cmdline.pipeline = false;
+	cmdline.shm = NULL;
+	cmdline.listen = NULL;
+	cmdline.flush = OUTPUT_FLUSH_LINE;
+	cmdline.flush_ms = 100;
+	cmdline.stats = false;
+	cmdline.stats_interval = 0.0;
+	cmdline.latency = false;
 
 	while (1) {
-		c = getopt_long(argc, argv, "cts:h",
+		c = getopt_long(argc, argv, "cBtTs:a:b:H:dr:RLDj:PS:l:F:Y:eh",
 				long_options, &idx);
 		if (c == -1)
 			break;
@@ -190,8 +928,14 @@ static int parse_args(int argc, char **argv)
 		case 'c':
 			cmdline.csv = true;
 			break;
+		case 'B':
+			cmdline.binary = true;
+			break;
 		case 't':
-			cmdline.timestamp = true;
+			cmdline.timestamp = OUTPUT_TS_SEC;
+			break;
+		case 'T':
+			cmdline.timestamp = OUTPUT_TS_USEC;
 			break;
 		case 's':
 			if (sscanf(optarg, "%lf", &cmdline.sleep) != 1) {
@@ -199,6 +943,88 @@ static int parse_args(int argc, char **argv)
 				return -1;
 			}
 			break;
+		case 'a':
+			if (sscanf(optarg, "%lf", &cmdline.aggregate) != 1 ||
+			    cmdline.aggregate <= 0.0) {
+				fprintf(stderr, "ERROR: Invalid --aggregate value\n");
+				return -1;
+			}
+			break;
+		case 'b':
+			unit = '\0';
+			if (sscanf(optarg, "%lf%c", &delta, &unit) < 1 ||
+			    (unit != '\0' && unit != '%') || delta < 0.0) {
+				fprintf(stderr, "ERROR: Invalid --deadband value\n");
+				return -1;
+			}
+			if (unit == '%')
+				cmdline.deadband_rel = delta / 100.0;
+			else
+				cmdline.deadband_abs = delta;
+			cmdline.deadband = true;
+			break;
+		case 'H':
+			if (sscanf(optarg, "%lf", &cmdline.heartbeat) != 1 ||
+			    cmdline.heartbeat <= 0.0) {
+				fprintf(stderr, "ERROR: Invalid --heartbeat value\n");
+				return -1;
+			}
+			cmdline.deadband = true;
+			break;
+		case 'd':
+			cmdline.debug = true;
+			break;
+		case 'r':
+			cmdline.record = optarg;
+			break;
+		case 'R':
+			cmdline.replay = REPLAY_FAST;
+			break;
+		case 'L':
+			cmdline.replay = REPLAY_REALTIME;
+			break;
+		case 'D':
+			cmdline.decode = true;
+			break;
+		case 'j':
+			if (sscanf(optarg, "%u", &cmdline.jobs) != 1) {
+				fprintf(stderr, "ERROR: Invalid --jobs value\n");
+				return -1;
+			}
+			break;
+		case 'P':
+			cmdline.pipeline = true;
+			break;
+		case 'S':
+			cmdline.shm = optarg;
+			break;
+		case 'l':
+			cmdline.listen = optarg;
+			break;
+		case 'F':
+			if (strcmp(optarg, "line") == 0) {
+				cmdline.flush = OUTPUT_FLUSH_LINE;
+			} else if (strcmp(optarg, "full") == 0) {
+				cmdline.flush = OUTPUT_FLUSH_FULL;
+			} else if (sscanf(optarg, "%d", &cmdline.flush_ms) == 1 &&
+				   cmdline.flush_ms > 0) {
+				cmdline.flush = OUTPUT_FLUSH_INTERVAL;
+			} else {
+				fprintf(stderr, "ERROR: Invalid --flush value\n");
+				return -1;
+			}
+			break;
+		case 'Y':
+			if (sscanf(optarg, "%lf", &cmdline.stats_interval) != 1 ||
+			    cmdline.stats_interval < 0.0) {
+				fprintf(stderr, "ERROR: Invalid --stats value\n");
+				return -1;
+			}
+			cmdline.stats = true;
+			break;
+		case 'e':
+			cmdline.latency = true;
+			break;
 		case 'h':
 			usage();
 			return 1;
@@ -206,25 +1032,56 @@ static int parse_args(int argc, char **argv)
 			return -1;
 		}
 	}
-	if (optind < argc)
-		cmdline.dev = argv[optind++];
-	if (optind < argc) {
+	cmdline.devs = &argv[optind];
+	cmdline.nr_devs = argc - optind;
+
+	if (!cmdline.nr_devs) {
+		fprintf(stderr, "ERROR: DEVICE node missing\n\n");
+		usage();
+		return -1;
+	}
+	if (cmdline.nr_devs > 1 &&
+	    (cmdline.record || cmdline.replay != REPLAY_OFF ||
+	     cmdline.decode || cmdline.debug)) {
 		fprintf(stderr, "ERROR: Too many arguments\n\n");
 		usage();
 		return -1;
 	}
-
-	if (!cmdline.dev) {
-		fprintf(stderr, "ERROR: DEVICE node missing\n\n");
+	if (cmdline.binary && cmdline.aggregate > 0.0) {
+		fprintf(stderr, "ERROR: --binary can't be used with --aggregate\n\n");
 		usage();
 		return -1;
 	}
+	if (cmdline.listen &&
+	    (cmdline.pipeline || cmdline.replay != REPLAY_OFF)) {
+		fprintf(stderr, "ERROR: --listen can't be used with "
+			"--pipeline or --replay\n\n");
+		usage();
+		return -1;
+	}
+	if (cmdline.stats && cmdline.decode) {
+		fprintf(stderr, "ERROR: --stats can't be used with --decode\n\n");
+		usage();
+		return -1;
+	}
+	if (cmdline.latency &&
+	    (cmdline.replay != REPLAY_OFF || cmdline.decode)) {
+		fprintf(stderr, "ERROR: --latency can only be used with live devices\n\n");
+		usage();
+		return -1;
+	}
+	if (cmdline.debug) {
+		/* The debug dumps go through stdio line by line. */
+		cmdline.flush = OUTPUT_FLUSH_LINE;
+	}
 
 	return 0;
 }
 
 int main(int argc, char **argv)
 {
+	struct meter *meters = NULL;
+	unsigned int i;
 	int ret = 1;
 	int err;
 
@@ -234,16 +1091,40 @@ int main(int argc, char **argv)
 	if (err)
 		goto out;
 
-	err = dump_es51984(ES51984_BOARD_AMPROBE_35XPA,
-			   cmdline.dev,
-			   cmdline.csv,
-			   cmdline.timestamp,
-			   cmdline.sleep);
+	if (cmdline.decode) {
+		enum es51984_board_type board;
+
+		parse_device_spec(cmdline.devs[0], &board);
+		err = decode_file(cmdline.devs[0],
+				  board,
+				  cmdline.jobs,
+				  cmdline.csv,
+				  cmdline.binary,
+				  cmdline.timestamp);
+		if (err)
+			goto out;
+		ret = 0;
+		goto out;
+	}
+
+	meters = calloc(cmdline.nr_devs, sizeof(*meters));
+	if (!meters) {
+		fprintf(stderr, "ERROR: Out of memory\n");
+		goto out;
+	}
+	for (i = 0; i < cmdline.nr_devs; i++) {
+		parse_device_spec(cmdline.devs[i], &meters[i].board);
+		meters[i].dev = cmdline.devs[i];
+		meters[i].index = i;
+	}
+
+	err = dump_es51984(meters, cmdline.nr_devs);
 	if (err)
 		goto out;
 
 	ret = 0;
 out:
+	free(meters);
 
 	return ret;
 }
@@ -0,0 +1,92 @@
+#ifndef MMMEAS_BINARY_H_
+#define MMMEAS_BINARY_H_
+
+/* mmmeas --binary output stream format.
+ *
+ * This header is self-contained. Consumers may copy it.
+ *
+ * The stream starts with one struct mmmeas_bin_header, followed by
+ * struct mmmeas_bin_record entries up to the end of the stream.
+ * All fields are little-endian. All structures are packed and have no
+ * padding. Record N therefore is at byte offset
+ *
+ *   sizeof(struct mmmeas_bin_header) + N * header.record_size
+ *
+ * Readers must use header.record_size as the record stride. Later
+ * versions of the format only append fields to the record.
+ */
+
+#include <stdint.h>
+
+
+#define MMMEAS_BIN_MAGIC	"MMMEASB\n"
+#define MMMEAS_BIN_VERSION	1
+
+/** struct mmmeas_bin_header - Stream header.
+ * @magic: MMMEAS_BIN_MAGIC without the terminating NUL.
+ * @version: MMMEAS_BIN_VERSION.
+ * @record_size: sizeof(struct mmmeas_bin_record) of the writer.
+ */
+struct mmmeas_bin_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+} __attribute__((__packed__));
+
+/* struct mmmeas_bin_record flags */
+#define MMMEAS_BIN_DC		0x0001	/* DC mode (else AC) */
+#define MMMEAS_BIN_AUTO		0x0002	/* Auto range (else manual) */
+#define MMMEAS_BIN_OVERFLOW	0x0004	/* Overflow. count is meaningless */
+#define MMMEAS_BIN_DEGREE	0x0008	/* Temperature in C (else F) */
+#define MMMEAS_BIN_BATT_LOW	0x0010	/* Battery low */
+#define MMMEAS_BIN_HOLD		0x0020	/* Hold active */
+#define MMMEAS_BIN_NEGATIVE	0x0040	/* The value is negative. This is
+					 * also set for -0 and for a negative
+					 * overflow, where count can't carry
+					 * the sign. */
+
+/** struct mmmeas_bin_record - One sample.
+ * The value of the sample is count * 10^exponent in the unit of
+ * the function. The unit is not always the SI base unit:
+ *
+ *   function  meaning              unit
+ *   0x3B      voltage              V
+ *   0x3D      micro-amps current   uA
+ *   0x3F      milli-amps current   mA
+ *   0x30      auto current         A
+ *   0x39      manual current       A
+ *   0x33      resistance           Ohms
+ *   0x35      continuity           Ohms
+ *   0x31      diode                V
+ *   0x32      frequency            Hz
+ *   0x36      capacitance          F
+ *   0x34      temperature          C with MMMEAS_BIN_DEGREE, else F
+ *   0x3E      ADP0                 Amprobe 35XP-A: degrees C or F
+ *   0x3C      ADP1                 Amprobe 35XP-A: degrees C or F
+ *   0x38      ADP2                 device specific
+ *   0x3A      ADP3                 device specific
+ *
+ * @realtime_ns: CLOCK_REALTIME arrival time in nanoseconds. 0 if unknown.
+ * @mono_ns: CLOCK_MONOTONIC arrival time in nanoseconds. 0 if unknown.
+ * @count: The signed digit count.
+ * @flags: MMMEAS_BIN_... flags.
+ * @exponent: The decimal exponent of count.
+ * @function: The ES51984 function code (enum es51984_func).
+ * @range: The range index of the function, starting at 0.
+ * @device: The index of the DEVICE on the command line, starting at 0.
+ * @reserved: Always 0.
+ */
+struct mmmeas_bin_record {
+	uint64_t realtime_ns;
+	uint64_t mono_ns;
+	int32_t count;
+	uint32_t flags;
+	int8_t exponent;
+	uint8_t function;
+	uint8_t range;
+	uint8_t device;
+	uint32_t reserved;
+} __attribute__((__packed__));
+
+
+#endif /* MMMEAS_BINARY_H_ */
@@ -0,0 +1,130 @@
+#ifndef MMMEAS_SHM_H_
+#define MMMEAS_SHM_H_
+
+/* mmmeas --shm latest value publication.
+ *
+ * mmmeas publishes the most recent sample of each DEVICE into a POSIX
+ * shared memory object. Every DEVICE has one slot, in command line order.
+ * A slot is protected by a sequence lock: The writer makes the sequence
+ * count odd while it updates the slot and even again when it is done.
+ * Readers retry until they copied the slot between two reads of the
+ * same even sequence count. Readers never block the writer and need
+ * no syscalls.
+ *
+ * Usage:
+ *
+ *   const struct mmmeas_shm *shm = mmmeas_shm_open("/mmmeas");
+ *   struct es51984_sample sample;
+ *   uint64_t serial;
+ *
+ *   serial = mmmeas_shm_read(&shm->slots[0], &sample);
+ *
+ * serial is the number of samples published to the slot so far.
+ * It is 0, if there was no sample, yet.
+ */
+
+#include "es51984.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define MMMEAS_SHM_MAGIC	"MMMEASS\n"
+#define MMMEAS_SHM_VERSION	1
+
+/** struct mmmeas_shm_slot - The latest sample of one DEVICE.
+ * @seq: Sequence lock count. Odd while the slot is updated.
+ * @serial: The number of samples published. 0 if none.
+ * @device: The DEVICE name. NUL terminated.
+ * @sample: The latest sample.
+ */
+struct mmmeas_shm_slot {
+	uint32_t seq;
+	uint32_t reserved;
+	uint64_t serial;
+	char device[64];
+	struct es51984_sample sample;
+} __attribute__((__aligned__(64)));
+
+/** struct mmmeas_shm - The shared memory object.
+ * @magic: MMMEAS_SHM_MAGIC without the terminating NUL.
+ * @version: MMMEAS_SHM_VERSION.
+ * @slot_size: sizeof(struct mmmeas_shm_slot) of the writer.
+ * @nr_slots: The number of slots.
+ * @slots: The slots.
+ */
+struct mmmeas_shm {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t nr_slots;
+	uint32_t reserved;
+	struct mmmeas_shm_slot slots[];
+} __attribute__((__aligned__(64)));
+
+/** mmmeas_shm_read - Read a consistent snapshot of a slot.
+ * Returns the serial number of the sample.
+ *
+ * @slot: The slot.
+ * @sample: Buffer for the sample.
+ */
+static inline uint64_t mmmeas_shm_read(const struct mmmeas_shm_slot *slot,
+				       struct es51984_sample *sample)
+{
+	uint32_t seq0, seq1;
+	uint64_t serial;
+
+	do {
+		seq0 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq0 & 1u)
+			continue; /* Update in progress. */
+		serial = slot->serial;
+		memcpy(sample, (const void *)&slot->sample, sizeof(*sample));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq1 = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+	} while ((seq0 & 1u) || seq0 != seq1);
+
+	return serial;
+}
+
+/** mmmeas_shm_open - Map a shared memory object for reading.
+ * Returns the mapping, or NULL on failure.
+ *
+ * @name: The name given to mmmeas --shm.
+ */
+static inline const struct mmmeas_shm * mmmeas_shm_open(const char *name)
+{
+	const struct mmmeas_shm *shm;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*shm)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	shm = map;
+	if (memcmp(shm->magic, MMMEAS_SHM_MAGIC, sizeof(shm->magic)) != 0 ||
+	    shm->version != MMMEAS_SHM_VERSION ||
+	    shm->slot_size != sizeof(struct mmmeas_shm_slot) ||
+	    sizeof(*shm) + (size_t)shm->nr_slots * shm->slot_size > (size_t)st.st_size) {
+		munmap(map, (size_t)st.st_size);
+		return NULL;
+	}
+
+	return shm;
+}
+
+
+#endif /* MMMEAS_SHM_H_ */
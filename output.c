@@ -0,0 +1,430 @@
+/*
+ *   Multimeter measurement
+ *   Text output formatting
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "output.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <endian.h>
+
+
+/* Bounded string builder with snprintf() semantics:
+ * Output beyond the end is dropped, but still counted. */
+struct outbuf {
+	char *p;
+	char *end;
+	size_t len;
+};
+
+static void put_mem(struct outbuf *o, const char *s, size_t len)
+{
+	size_t room = (size_t)(o->end - o->p);
+
+	if (len <= room) {
+		memcpy(o->p, s, len);
+		o->p += len;
+	} else {
+		memcpy(o->p, s, room);
+		o->p += room;
+	}
+	o->len += len;
+}
+
+static void put_str(struct outbuf *o, const char *s)
+{
+	put_mem(o, s, strlen(s));
+}
+
+static const uint64_t pow10_u64[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+};
+
+/* Format a double with a fixed number of fractional digits.
+ * The result is identical to printf("%.*f", prec, v). */
+static void put_fixed(struct outbuf *o, double v, unsigned int prec)
+{
+	char tmp[64];
+	char *d = tmp + sizeof(tmp);
+	uint64_t n, ipart, fpart;
+	double scaled;
+	unsigned int i;
+
+	scaled = fabs(v) * (double)pow10_u64[prec];
+	/* printf() rounds the exact binary value. The scaling above
+	 * might have moved it across a rounding tie. Let printf()
+	 * handle everything close to a tie, as well as huge,
+	 * infinite or NaN values. */
+	if (!(scaled < 1e15) ||
+	    fabs(scaled - floor(scaled) - 0.5) <= scaled * 1e-15 + 1e-9) {
+		snprintf(tmp, sizeof(tmp), "%.*f", (int)prec, v);
+		put_str(o, tmp);
+		return;
+	}
+	n = (uint64_t)nearbyint(scaled);
+	ipart = n / pow10_u64[prec];
+	fpart = n % pow10_u64[prec];
+
+	for (i = 0; i < prec; i++) {
+		*--d = (char)('0' + fpart % 10);
+		fpart /= 10;
+	}
+	if (prec)
+		*--d = '.';
+	do {
+		*--d = (char)('0' + ipart % 10);
+		ipart /= 10;
+	} while (ipart);
+	if (signbit(v))
+		*--d = '-';
+
+	put_mem(o, d, (size_t)(tmp + sizeof(tmp) - d));
+}
+
+/* The time stamp only changes once per second.
+ * Keep the last strftime() result per thread. */
+static __thread struct {
+	time_t t;
+	size_t len;
+	char buf[64];
+} tcache = { .t = (time_t)-1, };
+
+static void put_time(struct outbuf *o, int64_t t_ns,
+		     enum output_timestamp timestamp)
+{
+	char usec[8];
+	time_t t;
+	struct tm tm;
+	int64_t sub;
+	unsigned int i, frac;
+
+	t = (time_t)(t_ns / 1000000000);
+	sub = t_ns % 1000000000;
+	if (sub < 0) {
+		t--;
+		sub += 1000000000;
+	}
+	if (t != tcache.t) {
+		localtime_r(&t, &tm);
+		tcache.len = strftime(tcache.buf, sizeof(tcache.buf), "%F;%T", &tm);
+		tcache.t = t;
+	}
+	put_mem(o, tcache.buf, tcache.len);
+
+	if (timestamp == OUTPUT_TS_USEC) {
+		frac = (unsigned int)(sub / 1000);
+		usec[0] = '.';
+		for (i = 6; i > 0; i--) {
+			usec[i] = (char)('0' + frac % 10);
+			frac /= 10;
+		}
+		put_mem(o, usec, 7);
+	}
+}
+
+static const char * sample_units(const struct es51984_sample *sample)
+{
+	if (sample->function == ES51984_FUNC_TEMP)
+		return sample->degree ? "*C" : "F";
+	return es51984_get_units(sample);
+}
+
+static void put_u64(struct outbuf *o, uint64_t v)
+{
+	char tmp[24];
+	char *d = tmp + sizeof(tmp);
+
+	do {
+		*--d = (char)('0' + v % 10);
+		v /= 10;
+	} while (v);
+	put_mem(o, d, (size_t)(tmp + sizeof(tmp) - d));
+}
+
+static void put_prefix(struct outbuf *o, int64_t t_ns, bool csv,
+		       enum output_timestamp timestamp, const char *tag)
+{
+	if (tag) {
+		put_str(o, tag);
+		put_str(o, csv ? ";" : ": ");
+	}
+	if (timestamp != OUTPUT_TS_NONE) {
+		if (!csv)
+			put_mem(o, "[", 1);
+		put_time(o, t_ns, timestamp);
+		put_str(o, csv ? ";" : "] ");
+	}
+}
+
+static void put_modes(struct outbuf *o, const struct es51984_sample *sample,
+		      bool batt_low)
+{
+	put_str(o, sample->dc_mode ? "  (DC, " : "  (AC, ");
+	put_str(o, sample->auto_mode ? "auto, " : "man, ");
+	put_str(o, sample->hold ? "hold)" : "no-hold)");
+	if (batt_low)
+		put_str(o, " BATTERY LOW");
+}
+
+int output_format_sample(char *buf, size_t size,
+			 const struct es51984_sample *sample,
+			 int64_t t_ns,
+			 bool csv,
+			 enum output_timestamp timestamp,
+			 const char *tag)
+{
+	struct outbuf o;
+	const char *units;
+	double value;
+
+	o.p = buf;
+	o.end = size ? buf + size - 1 : buf;
+	o.len = 0;
+
+	units = sample_units(sample);
+	value = sample->overflow ? 0.0 : sample->value;
+
+	put_prefix(&o, t_ns, csv, timestamp, tag);
+	if (csv) {
+		put_fixed(&o, value, 6);
+	} else {
+		put_fixed(&o, value, 3);
+		put_mem(&o, " ", 1);
+		if (sample->overflow)
+			put_str(&o, "OVERFLOW ");
+		put_str(&o, units);
+		put_modes(&o, sample, sample->batt_low);
+	}
+	put_mem(&o, "\n", 1);
+	if (size)
+		*o.p = '\0';
+
+	return (int)o.len;
+}
+
+int output_format_aggregate(char *buf, size_t size,
+			    const struct aggregate *agg,
+			    int64_t t_ns,
+			    bool csv,
+			    enum output_timestamp timestamp,
+			    const char *tag)
+{
+	struct outbuf o;
+	const char *units;
+	unsigned int prec;
+
+	o.p = buf;
+	o.end = size ? buf + size - 1 : buf;
+	o.len = 0;
+
+	units = sample_units(&agg->mode);
+	prec = csv ? 6 : 3;
+
+	put_prefix(&o, t_ns, csv, timestamp, tag);
+	put_fixed(&o, agg->mean, prec);
+	put_str(&o, csv ? ";" : " ");
+	if (!csv) {
+		put_str(&o, units);
+		put_str(&o, "  min ");
+	}
+	put_fixed(&o, agg->min, prec);
+	put_str(&o, csv ? ";" : "  max ");
+	put_fixed(&o, agg->max, prec);
+	put_str(&o, csv ? ";" : "  stddev ");
+	put_fixed(&o, aggregate_stddev(agg), prec);
+	put_str(&o, csv ? ";" : "  n ");
+	put_u64(&o, agg->count);
+	put_str(&o, csv ? ";" : "  overflows ");
+	put_u64(&o, agg->overflows);
+	if (!csv)
+		put_modes(&o, &agg->mode, agg->batt_low);
+	put_mem(&o, "\n", 1);
+	if (size)
+		*o.p = '\0';
+
+	return (int)o.len;
+}
+
+void output_binary_header(struct mmmeas_bin_header *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, MMMEAS_BIN_MAGIC, sizeof(hdr->magic));
+	hdr->version = htole32(MMMEAS_BIN_VERSION);
+	hdr->record_size = htole32(sizeof(struct mmmeas_bin_record));
+}
+
+void output_binary_record(struct mmmeas_bin_record *rec,
+			  const struct es51984_sample *sample,
+			  int64_t realtime_ns,
+			  unsigned int device)
+{
+	uint32_t flags = 0;
+
+	if (sample->dc_mode)
+		flags |= MMMEAS_BIN_DC;
+	if (sample->auto_mode)
+		flags |= MMMEAS_BIN_AUTO;
+	if (sample->overflow)
+		flags |= MMMEAS_BIN_OVERFLOW;
+	if (sample->degree)
+		flags |= MMMEAS_BIN_DEGREE;
+	if (sample->batt_low)
+		flags |= MMMEAS_BIN_BATT_LOW;
+	if (sample->hold)
+		flags |= MMMEAS_BIN_HOLD;
+	if (signbit(sample->value))
+		flags |= MMMEAS_BIN_NEGATIVE;
+
+	rec->realtime_ns = htole64((uint64_t)realtime_ns);
+	rec->mono_ns = htole64((uint64_t)sample->mono_ns);
+	rec->count = (int32_t)htole32((uint32_t)sample->count);
+	rec->flags = htole32(flags);
+	rec->exponent = (int8_t)sample->exponent;
+	rec->function = (uint8_t)sample->function;
+	rec->range = (uint8_t)sample->range;
+	rec->device = (uint8_t)device;
+	rec->reserved = 0;
+}
+
+static int64_t writer_clock_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int64_t writer_clock_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int write_all(struct output_writer *w, const char *data, size_t len)
+{
+	size_t pos = 0;
+	ssize_t res;
+
+	while (pos < len) {
+		res = write(w->fd, data + pos, len - pos);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (!w->err) {
+				fprintf(stderr, "ERROR: Failed to write output: %s\n",
+					strerror(errno));
+			}
+			w->err = -EIO;
+			break;
+		}
+		pos += (size_t)res;
+	}
+
+	return w->err;
+}
+
+int output_flush(struct output_writer *w)
+{
+	int err = 0;
+	int64_t now;
+	unsigned int i;
+
+	if (w->len)
+		err = write_all(w, w->buf, w->len);
+	w->len = 0;
+	w->last_flush = writer_clock_msec();
+
+	if (w->nr_stamps) {
+		now = writer_clock_nsec();
+		for (i = 0; i < w->nr_stamps; i++)
+			histogram_record(w->latency, now - w->stamps[i]);
+		w->nr_stamps = 0;
+	}
+
+	return err;
+}
+
+int output_write(struct output_writer *w, const char *line, size_t len)
+{
+	int err = 0;
+
+	if (len > w->size - w->len) {
+		err = output_flush(w);
+		if (len > w->size)
+			return write_all(w, line, len);
+	}
+	memcpy(w->buf + w->len, line, len);
+	w->len += len;
+
+	switch (w->policy) {
+	case OUTPUT_FLUSH_LINE:
+		err = output_flush(w);
+		break;
+	case OUTPUT_FLUSH_INTERVAL:
+		if (writer_clock_msec() - w->last_flush >= w->interval_ms)
+			err = output_flush(w);
+		break;
+	case OUTPUT_FLUSH_FULL:
+		break;
+	}
+
+	return err;
+}
+
+int output_write_stamped(struct output_writer *w, const char *line, size_t len,
+			 int64_t t_ns)
+{
+	if (!w->latency)
+		return output_write(w, line, len);
+
+	/* Flush the older data first, so that the stamp only covers
+	 * the flush that writes this data. */
+	if (len > w->size - w->len || w->nr_stamps >= OUTPUT_STAMPS)
+		output_flush(w);
+	w->stamps[w->nr_stamps++] = t_ns;
+
+	return output_write(w, line, len);
+}
+
+void output_writer_latency(struct output_writer *w, struct histogram *h)
+{
+	w->latency = h;
+}
+
+int output_writer_init(struct output_writer *w, int fd,
+		       enum output_flush_policy policy,
+		       int interval_ms)
+{
+	memset(w, 0, sizeof(*w));
+	w->fd = fd;
+	w->policy = policy;
+	w->interval_ms = interval_ms;
+	w->size = sizeof(w->buf);
+	w->last_flush = writer_clock_msec();
+
+	return 0;
+}
+
+int output_writer_exit(struct output_writer *w)
+{
+	return output_flush(w);
+}
@@ -0,0 +1,160 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+/* mmmeas text output formatting. */
+
+#include "es51984.h"
+#include "aggregate.h"
+#include "histogram.h"
+#include "mmmeas_binary.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+
+enum output_timestamp {
+	OUTPUT_TS_NONE,		/* No time stamp */
+	OUTPUT_TS_SEC,		/* Time stamp with 1 s resolution */
+	OUTPUT_TS_USEC,		/* Time stamp with 1 us resolution */
+};
+
+/** output_format_sample - Format a sample as one line of text.
+ *
+ * Returns the length of the line including the newline, like snprintf().
+ *
+ * @buf: The destination buffer.
+ * @size: The size of the destination buffer.
+ * @sample: The sample.
+ * @t_ns: The CLOCK_REALTIME time stamp of the sample, in nanoseconds.
+ * @csv: If true, use CSV output.
+ * @timestamp: The time stamp format.
+ * @tag: Prefix that identifies the device, or NULL.
+ */
+int output_format_sample(char *buf, size_t size,
+			 const struct es51984_sample *sample,
+			 int64_t t_ns,
+			 bool csv,
+			 enum output_timestamp timestamp,
+			 const char *tag);
+
+
+/** output_format_aggregate - Format the statistics of a window as one line.
+ *
+ * Returns the length of the line including the newline, like snprintf().
+ * The text format is:
+ *   MEAN UNITS  min MIN  max MAX  stddev STDDEV  n COUNT  overflows OVL  (MODES)
+ * The CSV format is:
+ *   MEAN;MIN;MAX;STDDEV;COUNT;OVL
+ *
+ * @buf: The destination buffer.
+ * @size: The size of the destination buffer.
+ * @agg: The window statistics.
+ * @t_ns: The CLOCK_REALTIME time stamp of the window, in nanoseconds.
+ * @csv: If true, use CSV output.
+ * @timestamp: The time stamp format.
+ * @tag: Prefix that identifies the device, or NULL.
+ */
+int output_format_aggregate(char *buf, size_t size,
+			    const struct aggregate *agg,
+			    int64_t t_ns,
+			    bool csv,
+			    enum output_timestamp timestamp,
+			    const char *tag);
+
+/** output_binary_header - Fill the --binary stream header. */
+void output_binary_header(struct mmmeas_bin_header *hdr);
+
+/** output_binary_record - Convert a sample to a --binary record.
+ *
+ * @rec: The destination record.
+ * @sample: The sample.
+ * @realtime_ns: The CLOCK_REALTIME time stamp of the sample, in nanoseconds.
+ * @device: The device index.
+ */
+void output_binary_record(struct mmmeas_bin_record *rec,
+			  const struct es51984_sample *sample,
+			  int64_t realtime_ns,
+			  unsigned int device);
+
+enum output_flush_policy {
+	OUTPUT_FLUSH_LINE,	/* Flush after every line */
+	OUTPUT_FLUSH_INTERVAL,	/* Flush every interval_ms */
+	OUTPUT_FLUSH_FULL,	/* Flush when the buffer is full */
+};
+
+/* Maximum number of buffered stamps. The buffer is flushed early,
+ * if more stamped data is written. */
+#define OUTPUT_STAMPS		1024
+
+/* Buffered output to a file descriptor. */
+struct output_writer {
+	int fd;
+	enum output_flush_policy policy;
+	int interval_ms;
+	int64_t last_flush;	/* CLOCK_MONOTONIC msec */
+	int err;		/* Sticky write error */
+	size_t len;
+	size_t size;
+	char buf[64 * 1024];
+
+	/* Write latency measurement. The stamps of the buffered data
+	 * are recorded in 'latency', when the data is written. */
+	struct histogram *latency;
+	unsigned int nr_stamps;
+	int64_t stamps[OUTPUT_STAMPS];
+};
+
+/** output_writer_init - Initialize a buffered writer.
+ * Returns zero on success, or a negative error on failure.
+ *
+ * @w: The writer.
+ * @fd: The file descriptor to write to.
+ * @policy: When to flush the buffer.
+ * @interval_ms: The flush interval for OUTPUT_FLUSH_INTERVAL.
+ */
+int output_writer_init(struct output_writer *w, int fd,
+		       enum output_flush_policy policy,
+		       int interval_ms);
+
+/** output_writer_exit - Flush and shut down a buffered writer.
+ * Returns zero on success, or a negative error on failure.
+ */
+int output_writer_exit(struct output_writer *w);
+
+/** output_write - Append data to the writer and flush as needed.
+ * Returns zero on success, or a negative error on failure.
+ * Write errors are sticky. They are reported only once.
+ *
+ * @w: The writer.
+ * @line: The data.
+ * @len: The length of the data, in bytes.
+ */
+int output_write(struct output_writer *w, const char *line, size_t len);
+
+/** output_writer_latency - Measure the write latency of stamped data.
+ * @w: The writer.
+ * @h: The histogram that records the latencies, or NULL.
+ */
+void output_writer_latency(struct output_writer *w, struct histogram *h);
+
+/** output_write_stamped - Append data with a time stamp.
+ * This is output_write(), but if latency measurement is enabled,
+ * the time from t_ns until the data is written is recorded.
+ *
+ * @w: The writer.
+ * @line: The data.
+ * @len: The length of the data, in bytes.
+ * @t_ns: CLOCK_MONOTONIC time when the data became ready.
+ */
+int output_write_stamped(struct output_writer *w, const char *line, size_t len,
+			 int64_t t_ns);
+
+/** output_flush - Write all buffered data.
+ * Returns zero on success, or a negative error on failure.
+ */
+int output_flush(struct output_writer *w);
+
+
+#endif /* OUTPUT_H_ */
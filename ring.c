@@ -0,0 +1,177 @@
+/*
+ *   Multimeter measurement
+ *   Lock-free single-producer/single-consumer ring buffer
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+
+/* The indices are free running. Only the consumer writes tail and
+ * only the producer writes head. The waiting flags and the eventfds
+ * are only touched when one side runs dry, so the fast path is free
+ * of syscalls and locked instructions. */
+
+static void efd_signal(int fd)
+{
+	uint64_t one = 1;
+	ssize_t res;
+
+	do {
+		res = write(fd, &one, sizeof(one));
+	} while (res < 0 && errno == EINTR);
+}
+
+static void efd_wait(int fd)
+{
+	uint64_t count;
+	ssize_t res;
+
+	do {
+		res = read(fd, &count, sizeof(count));
+	} while (res < 0 && errno == EINTR);
+}
+
+static bool ring_full(struct ring *ring)
+{
+	if (ring->head - ring->tail_cache <= ring->mask)
+		return false;
+	ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	return ring->head - ring->tail_cache > ring->mask;
+}
+
+static bool ring_empty(struct ring *ring)
+{
+	if (ring->tail != ring->head_cache)
+		return false;
+	ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	return ring->tail == ring->head_cache;
+}
+
+void * ring_push_slot(struct ring *ring)
+{
+	if (ring_full(ring))
+		return NULL;
+	return ring->buf + (ring->head & ring->mask) * ring->entry_size;
+}
+
+void ring_push_commit(struct ring *ring)
+{
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+	/* Pairs with the fence in ring_wait_data(). */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_RELAXED))
+		efd_signal(ring->data_fd);
+}
+
+void ring_wait_space(struct ring *ring)
+{
+	while (ring_full(ring)) {
+		__atomic_store_n(&ring->producer_waiting, true, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_full(ring))
+			efd_wait(ring->space_fd);
+		__atomic_store_n(&ring->producer_waiting, false, __ATOMIC_RELAXED);
+	}
+}
+
+void ring_close(struct ring *ring)
+{
+	__atomic_store_n(&ring->closed, true, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->consumer_waiting, __ATOMIC_RELAXED))
+		efd_signal(ring->data_fd);
+}
+
+void * ring_pop_slot(struct ring *ring)
+{
+	if (ring_empty(ring))
+		return NULL;
+	return ring->buf + (ring->tail & ring->mask) * ring->entry_size;
+}
+
+void ring_pop_commit(struct ring *ring)
+{
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+	/* Pairs with the fence in ring_wait_space(). */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->producer_waiting, __ATOMIC_RELAXED))
+		efd_signal(ring->space_fd);
+}
+
+bool ring_wait_data(struct ring *ring)
+{
+	while (ring_empty(ring)) {
+		if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+			return !ring_empty(ring);
+		__atomic_store_n(&ring->consumer_waiting, true, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_empty(ring) &&
+		    !__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE))
+			efd_wait(ring->data_fd);
+		__atomic_store_n(&ring->consumer_waiting, false, __ATOMIC_RELAXED);
+	}
+
+	return true;
+}
+
+int ring_init(struct ring *ring, size_t nr_entries, size_t entry_size)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+
+	if (!nr_entries || (nr_entries & (nr_entries - 1))) {
+		fprintf(stderr, "ERROR: Ring size is not a power of two.\n");
+		return -EINVAL;
+	}
+	ring->mask = nr_entries - 1;
+	ring->entry_size = entry_size;
+
+	ring->buf = calloc(nr_entries, entry_size);
+	if (!ring->buf) {
+		fprintf(stderr, "Out of memory\n");
+		return -ENOMEM;
+	}
+	ring->data_fd = eventfd(0, EFD_CLOEXEC);
+	ring->space_fd = eventfd(0, EFD_CLOEXEC);
+	if (ring->data_fd < 0 || ring->space_fd < 0) {
+		fprintf(stderr, "ERROR: Failed to create eventfd: %s\n",
+			strerror(errno));
+		ring_exit(ring);
+		return -EIO;
+	}
+
+	return 0;
+}
+
+void ring_exit(struct ring *ring)
+{
+	if (ring->data_fd >= 0)
+		close(ring->data_fd);
+	if (ring->space_fd >= 0)
+		close(ring->space_fd);
+	ring->data_fd = -1;
+	ring->space_fd = -1;
+	free(ring->buf);
+	ring->buf = NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef RING_H_
+#define RING_H_
+
+/* Lock-free single-producer/single-consumer ring buffer. */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+#define RING_CACHELINE	64
+
+struct ring {
+	/* Written by the producer only. */
+	size_t head __attribute__((__aligned__(RING_CACHELINE)));
+	size_t tail_cache;	/* Producer's copy of tail */
+	bool producer_waiting;
+
+	/* Written by the consumer only. */
+	size_t tail __attribute__((__aligned__(RING_CACHELINE)));
+	size_t head_cache;	/* Consumer's copy of head */
+	bool consumer_waiting;
+
+	/* Read-only after ring_init(). */
+	unsigned char *buf __attribute__((__aligned__(RING_CACHELINE)));
+	size_t mask;
+	size_t entry_size;
+	int data_fd;		/* eventfd: Data became available. */
+	int space_fd;		/* eventfd: Space became available. */
+	bool closed;		/* Producer finished */
+};
+
+/** ring_init - Initialize a ring.
+ * Returns zero on success, or a negative error on failure.
+ *
+ * @ring: The ring to initialize.
+ * @nr_entries: The number of entries. Must be a power of two.
+ * @entry_size: The size of one entry, in bytes.
+ */
+int ring_init(struct ring *ring, size_t nr_entries, size_t entry_size);
+
+/** ring_exit - Free a ring. */
+void ring_exit(struct ring *ring);
+
+/** ring_push_slot - Get the next free entry.
+ * Returns a pointer to the entry, or NULL if the ring is full.
+ * Producer only. The entry is published by ring_push_commit().
+ */
+void * ring_push_slot(struct ring *ring);
+
+/** ring_push_commit - Publish the entry returned by ring_push_slot().
+ * Producer only.
+ */
+void ring_push_commit(struct ring *ring);
+
+/** ring_wait_space - Block until the ring is not full.
+ * Producer only.
+ */
+void ring_wait_space(struct ring *ring);
+
+/** ring_close - Mark the end of the data stream.
+ * Producer only. The producer must not push after closing.
+ */
+void ring_close(struct ring *ring);
+
+/** ring_pop_slot - Get the oldest published entry.
+ * Returns a pointer to the entry, or NULL if the ring is empty.
+ * Consumer only. The entry is released by ring_pop_commit().
+ */
+void * ring_pop_slot(struct ring *ring);
+
+/** ring_pop_commit - Release the entry returned by ring_pop_slot().
+ * Consumer only.
+ */
+void ring_pop_commit(struct ring *ring);
+
+/** ring_wait_data - Block until the ring is not empty.
+ * Returns false, if the ring is empty and closed.
+ * Consumer only.
+ */
+bool ring_wait_data(struct ring *ring);
+
+
+#endif /* RING_H_ */
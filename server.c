@@ -0,0 +1,353 @@
+/*
+ *   Multimeter measurement
+ *   Unix domain socket sample server
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "server.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+
+/* Maximum number of messages per sendmsg() call. */
+#define SERVER_MAX_IOV		64
+
+/* A reference counted message. It is shared by all client queues. */
+struct server_msg {
+	unsigned int refcount;
+	size_t len;
+	unsigned char data[];
+};
+
+struct server_client {
+	struct server_client *next;
+	struct server *srv;
+	int fd;
+	unsigned int id;
+
+	/* Ring of queued messages. The first message may have been
+	 * partially sent. 'offset' bytes of it are gone already. */
+	struct server_msg *queue[SERVER_QUEUE_LEN];
+	unsigned int head;
+	unsigned int count;
+	size_t offset;
+
+	bool pollout;		/* Waiting for EPOLLOUT */
+	unsigned long sent;	/* Messages sent */
+	unsigned long dropped;	/* Messages dropped from a full queue */
+};
+
+struct server {
+	struct evloop *loop;
+	char *path;
+	int fd;
+	struct server_client *clients;
+	unsigned int next_id;
+	struct server_msg *greeting;
+};
+
+
+static struct server_msg * msg_alloc(const void *data, size_t len)
+{
+	struct server_msg *msg;
+
+	msg = malloc(sizeof(*msg) + len);
+	if (!msg)
+		return NULL;
+	msg->refcount = 1;
+	msg->len = len;
+	memcpy(msg->data, data, len);
+
+	return msg;
+}
+
+static void msg_put(struct server_msg *msg)
+{
+	if (msg && --msg->refcount == 0)
+		free(msg);
+}
+
+static void client_remove(struct server_client *cl)
+{
+	struct server *srv = cl->srv;
+	struct server_client **pp;
+
+	fprintf(stderr, "Client %u disconnected. "
+		"%lu messages sent, %lu dropped.\n",
+		cl->id, cl->sent, cl->dropped);
+
+	for (pp = &srv->clients; *pp; pp = &(*pp)->next) {
+		if (*pp == cl) {
+			*pp = cl->next;
+			break;
+		}
+	}
+	evloop_del(srv->loop, cl->fd);
+	close(cl->fd);
+	while (cl->count) {
+		msg_put(cl->queue[cl->head]);
+		cl->head = (cl->head + 1) % SERVER_QUEUE_LEN;
+		cl->count--;
+	}
+	free(cl);
+}
+
+static void client_enqueue(struct server_client *cl, struct server_msg *msg)
+{
+	unsigned int second;
+
+	if (cl->count >= SERVER_QUEUE_LEN) {
+		/* Drop the oldest message. A partially sent message
+		 * must be completed, so drop the one after it. */
+		if (cl->offset) {
+			second = (cl->head + 1) % SERVER_QUEUE_LEN;
+			msg_put(cl->queue[second]);
+			cl->queue[second] = cl->queue[cl->head];
+		} else {
+			msg_put(cl->queue[cl->head]);
+		}
+		cl->head = (cl->head + 1) % SERVER_QUEUE_LEN;
+		cl->count--;
+		cl->dropped++;
+	}
+	msg->refcount++;
+	cl->queue[(cl->head + cl->count) % SERVER_QUEUE_LEN] = msg;
+	cl->count++;
+}
+
+/* Send as much of the queue as the socket takes without blocking.
+ * Returns 0 on success or a negative error code, if the client is gone. */
+static int client_flush(struct server_client *cl)
+{
+	struct iovec iov[SERVER_MAX_IOV];
+	struct server_msg *msg;
+	struct msghdr mh;
+	unsigned int i, nr;
+	size_t done;
+	ssize_t res;
+
+	while (cl->count) {
+		nr = cl->count < SERVER_MAX_IOV ? cl->count : SERVER_MAX_IOV;
+		for (i = 0; i < nr; i++) {
+			msg = cl->queue[(cl->head + i) % SERVER_QUEUE_LEN];
+			iov[i].iov_base = msg->data;
+			iov[i].iov_len = msg->len;
+		}
+		iov[0].iov_base = (unsigned char *)iov[0].iov_base + cl->offset;
+		iov[0].iov_len -= cl->offset;
+
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = nr;
+		res = sendmsg(cl->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -EPIPE;
+		}
+
+		/* Release the messages that are sent completely. */
+		done = (size_t)res + cl->offset;
+		cl->offset = 0;
+		while (cl->count) {
+			msg = cl->queue[cl->head];
+			if (done < msg->len) {
+				cl->offset = done;
+				break;
+			}
+			done -= msg->len;
+			msg_put(msg);
+			cl->head = (cl->head + 1) % SERVER_QUEUE_LEN;
+			cl->count--;
+			cl->sent++;
+		}
+		if (cl->offset)
+			break; /* Socket buffer is full. */
+	}
+
+	/* Only wait for EPOLLOUT while there is something to send. */
+	if (!!cl->count != cl->pollout) {
+		cl->pollout = !!cl->count;
+		evloop_mod(cl->srv->loop, cl->fd,
+			   EPOLLIN | (cl->pollout ? EPOLLOUT : 0));
+	}
+
+	return 0;
+}
+
+static void client_event(struct evloop *loop, int fd, uint32_t events, void *ctx)
+{
+	struct server_client *cl = ctx;
+	char buf[256];
+	ssize_t res;
+
+	if (events & EPOLLIN) {
+		/* Clients don't send anything. Detect EOF. */
+		res = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (res == 0 || (res < 0 && errno != EAGAIN && errno != EINTR)) {
+			client_remove(cl);
+			return;
+		}
+	}
+	if (events & (EPOLLHUP | EPOLLERR)) {
+		client_remove(cl);
+		return;
+	}
+	if (events & EPOLLOUT) {
+		if (client_flush(cl))
+			client_remove(cl);
+	}
+}
+
+static void server_event(struct evloop *loop, int fd, uint32_t events, void *ctx)
+{
+	struct server *srv = ctx;
+	struct server_client *cl;
+	int cfd;
+
+	cfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (cfd < 0)
+		return;
+	cl = calloc(1, sizeof(*cl));
+	if (!cl) {
+		fprintf(stderr, "Out of memory\n");
+		close(cfd);
+		return;
+	}
+	cl->srv = srv;
+	cl->fd = cfd;
+	cl->id = srv->next_id++;
+	if (evloop_add(loop, cfd, EPOLLIN, client_event, cl)) {
+		close(cfd);
+		free(cl);
+		return;
+	}
+	cl->next = srv->clients;
+	srv->clients = cl;
+	fprintf(stderr, "Client %u connected.\n", cl->id);
+
+	if (srv->greeting) {
+		client_enqueue(cl, srv->greeting);
+		if (client_flush(cl))
+			client_remove(cl);
+	}
+}
+
+void server_broadcast(struct server *srv, const void *data, size_t len)
+{
+	struct server_client *cl, *next;
+	struct server_msg *msg;
+
+	if (!srv->clients)
+		return;
+	msg = msg_alloc(data, len);
+	if (!msg) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	for (cl = srv->clients; cl; cl = next) {
+		next = cl->next;
+		client_enqueue(cl, msg);
+		/* A client that waits for EPOLLOUT can't take more now. */
+		if (!cl->pollout && client_flush(cl))
+			client_remove(cl);
+	}
+	msg_put(msg);
+}
+
+struct server * server_init(struct evloop *loop, const char *path,
+			    const void *greeting, size_t greeting_len)
+{
+	struct sockaddr_un addr;
+	struct server *srv;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: Socket path too long: %s\n", path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	srv = calloc(1, sizeof(*srv));
+	if (!srv) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	srv->loop = loop;
+	srv->fd = -1;
+	srv->path = strdup(path);
+	if (!srv->path)
+		goto err;
+	if (greeting) {
+		srv->greeting = msg_alloc(greeting, greeting_len);
+		if (!srv->greeting)
+			goto err;
+	}
+
+	srv->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (srv->fd < 0) {
+		fprintf(stderr, "ERROR: Failed to create socket: %s\n",
+			strerror(errno));
+		goto err;
+	}
+	unlink(path);
+	if (bind(srv->fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(srv->fd, 16)) {
+		fprintf(stderr, "ERROR: Failed to listen on %s: %s\n",
+			path, strerror(errno));
+		goto err;
+	}
+	if (evloop_add(loop, srv->fd, EPOLLIN, server_event, srv))
+		goto err_unlink;
+
+	return srv;
+
+err_unlink:
+	unlink(path);
+err:
+	if (srv->fd >= 0)
+		close(srv->fd);
+	msg_put(srv->greeting);
+	free(srv->path);
+	free(srv);
+	return NULL;
+}
+
+void server_exit(struct server *srv)
+{
+	if (!srv)
+		return;
+	while (srv->clients) {
+		/* Try to deliver what is queued. */
+		client_flush(srv->clients);
+		client_remove(srv->clients);
+	}
+	evloop_del(srv->loop, srv->fd);
+	close(srv->fd);
+	unlink(srv->path);
+	msg_put(srv->greeting);
+	free(srv->path);
+	free(srv);
+}
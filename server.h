@@ -0,0 +1,44 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+/* Unix domain socket sample server. */
+
+#include "evloop.h"
+
+#include <stddef.h>
+
+
+/* Maximum number of queued messages per client. */
+#define SERVER_QUEUE_LEN	1024
+
+struct server;
+
+/** server_init - Listen on a Unix domain socket.
+ * Returns the server, or NULL on failure.
+ *
+ * @loop: The event loop that serves the clients.
+ * @path: The socket path. An existing socket file is replaced.
+ * @greeting: Data sent to every new client first, or NULL.
+ * @greeting_len: The length of the greeting.
+ */
+struct server * server_init(struct evloop *loop, const char *path,
+			    const void *greeting, size_t greeting_len);
+
+/** server_exit - Disconnect all clients and remove the socket. */
+void server_exit(struct server *srv);
+
+/** server_broadcast - Send data to all clients.
+ *
+ * The data is copied once and shared by all client queues.
+ * It is sent with non-blocking writes. If the queue of a client is
+ * full, the oldest message in the queue is dropped and counted.
+ * This never blocks.
+ *
+ * @srv: The server.
+ * @data: The data.
+ * @len: The length of the data.
+ */
+void server_broadcast(struct server *srv, const void *data, size_t len);
+
+
+#endif /* SERVER_H_ */
@@ -0,0 +1,124 @@
+/*
+ *   Multimeter measurement
+ *   Shared memory latest value publisher
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "shm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+struct shm_pub {
+	char *name;
+	struct mmmeas_shm *shm;
+	size_t size;
+};
+
+void shm_pub_publish(struct shm_pub *pub, unsigned int slot,
+		     const struct es51984_sample *sample)
+{
+	struct mmmeas_shm_slot *s = &pub->shm->slots[slot];
+	uint32_t seq = s->seq;
+
+	/* Make the count odd before touching the data. */
+	__atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	s->serial++;
+	s->sample = *sample;
+
+	/* Publish the data with an even count. */
+	__atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+struct shm_pub * shm_pub_init(const char *name,
+			      const char * const *devices,
+			      unsigned int nr_devices)
+{
+	struct shm_pub *pub;
+	unsigned int i;
+	void *map;
+	int fd;
+
+	pub = calloc(1, sizeof(*pub));
+	if (!pub) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	pub->name = strdup(name);
+	if (!pub->name) {
+		fprintf(stderr, "Out of memory\n");
+		goto err_free;
+	}
+	pub->size = sizeof(struct mmmeas_shm) +
+		    nr_devices * sizeof(struct mmmeas_shm_slot);
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Failed to create shared memory %s: %s\n",
+			name, strerror(errno));
+		goto err_free;
+	}
+	if (ftruncate(fd, (off_t)pub->size)) {
+		fprintf(stderr, "ERROR: Failed to resize shared memory %s: %s\n",
+			name, strerror(errno));
+		goto err_unlink;
+	}
+	map = mmap(NULL, pub->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Failed to map shared memory %s: %s\n",
+			name, strerror(errno));
+		goto err_unlink;
+	}
+	close(fd);
+	pub->shm = map;
+
+	for (i = 0; i < nr_devices; i++) {
+		strncpy(pub->shm->slots[i].device, devices[i],
+			sizeof(pub->shm->slots[i].device) - 1);
+	}
+	pub->shm->version = MMMEAS_SHM_VERSION;
+	pub->shm->slot_size = sizeof(struct mmmeas_shm_slot);
+	pub->shm->nr_slots = nr_devices;
+	/* Readers check the magic. Write it last. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(pub->shm->magic, MMMEAS_SHM_MAGIC, sizeof(pub->shm->magic));
+
+	return pub;
+
+err_unlink:
+	close(fd);
+	shm_unlink(name);
+err_free:
+	free(pub->name);
+	free(pub);
+	return NULL;
+}
+
+void shm_pub_exit(struct shm_pub *pub)
+{
+	if (!pub)
+		return;
+	munmap(pub->shm, pub->size);
+	shm_unlink(pub->name);
+	free(pub->name);
+	free(pub);
+}
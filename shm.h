@@ -0,0 +1,36 @@
+#ifndef SHM_H_
+#define SHM_H_
+
+/* Shared memory latest value publisher. See mmmeas_shm.h. */
+
+#include "mmmeas_shm.h"
+
+
+struct shm_pub;
+
+/** shm_pub_init - Create the shared memory object.
+ * Returns the publisher, or NULL on failure.
+ *
+ * @name: The POSIX shared memory object name, e.g. "/mmmeas".
+ * @devices: The DEVICE names. One slot is created per DEVICE.
+ * @nr_devices: The number of DEVICEs.
+ */
+struct shm_pub * shm_pub_init(const char *name,
+			      const char * const *devices,
+			      unsigned int nr_devices);
+
+/** shm_pub_exit - Remove the shared memory object. */
+void shm_pub_exit(struct shm_pub *pub);
+
+/** shm_pub_publish - Publish the latest sample of a DEVICE.
+ * Only one thread may publish to a slot.
+ *
+ * @pub: The publisher.
+ * @slot: The DEVICE index.
+ * @sample: The sample.
+ */
+void shm_pub_publish(struct shm_pub *pub, unsigned int slot,
+		     const struct es51984_sample *sample);
+
+
+#endif /* SHM_H_ */
@@ -0,0 +1,152 @@
+/*
+ *   Multimeter measurement
+ *   Golden frame corpus
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "corpus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+static const struct {
+	const char *name;
+	enum es51984_board_type board;
+} corpus_boards[] = {
+	{ "unknown", ES51984_BOARD_UNKNOWN, },
+	{ "35xpa", ES51984_BOARD_AMPROBE_35XPA, },
+};
+
+const char * corpus_board_name(enum es51984_board_type board)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(corpus_boards) / sizeof(corpus_boards[0]); i++) {
+		if (corpus_boards[i].board == board)
+			return corpus_boards[i].name;
+	}
+	return "?";
+}
+
+void corpus_format(char *buf, const struct es51984_sample *sample, int error)
+{
+	if (error) {
+		snprintf(buf, CORPUS_RESULT_LEN, "error");
+		return;
+	}
+	snprintf(buf, CORPUS_RESULT_LEN,
+		 "f=%02X r=%d c=%d e=%d v=%.17g dc=%d auto=%d ol=%d deg=%d "
+		 "batt=%d hold=%d u=%s",
+		 (unsigned int)sample->function, sample->range,
+		 (int)sample->count, sample->exponent, sample->value,
+		 sample->dc_mode, sample->auto_mode, sample->overflow,
+		 sample->degree, sample->batt_low, sample->hold,
+		 es51984_get_units(sample));
+}
+
+/* Parse one corpus line. Returns 1 on success, 0 for an empty line
+ * or -EINVAL for a malformed line. */
+static int corpus_parse(char *line, struct corpus_entry *e)
+{
+	char *board, *hex, *result, *end;
+	uint8_t *raw = (uint8_t *)&e->raw;
+	unsigned int i, byte;
+
+	end = line + strcspn(line, "\r\n");
+	*end = '\0';
+	if (line[0] == '\0' || line[0] == '#')
+		return 0;
+
+	board = line;
+	hex = strchr(board, ' ');
+	if (!hex)
+		return -EINVAL;
+	*hex++ = '\0';
+	result = strchr(hex, ' ');
+	if (!result)
+		return -EINVAL;
+	*result++ = '\0';
+
+	for (i = 0; i < sizeof(corpus_boards) / sizeof(corpus_boards[0]); i++) {
+		if (strcmp(board, corpus_boards[i].name) == 0)
+			break;
+	}
+	if (i >= sizeof(corpus_boards) / sizeof(corpus_boards[0]))
+		return -EINVAL;
+	e->board = corpus_boards[i].board;
+
+	if (strlen(hex) != sizeof(e->raw) * 2)
+		return -EINVAL;
+	for (i = 0; i < sizeof(e->raw); i++) {
+		if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+			return -EINVAL;
+		raw[i] = (uint8_t)byte;
+	}
+
+	if (strlen(result) >= sizeof(e->expected))
+		return -EINVAL;
+	strcpy(e->expected, result);
+
+	return 1;
+}
+
+int corpus_load(const char *path, struct corpus_entry **entries)
+{
+	struct corpus_entry *array = NULL, *tmp;
+	unsigned int nr = 0, alloc = 0, line = 0;
+	char buf[256];
+	FILE *fd;
+	int res;
+
+	fd = fopen(path, "r");
+	if (!fd) {
+		fprintf(stderr, "ERROR: Failed to open %s: %s\n",
+			path, strerror(errno));
+		return -EIO;
+	}
+	while (fgets(buf, sizeof(buf), fd)) {
+		line++;
+		if (nr >= alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(array, alloc * sizeof(*array));
+			if (!tmp) {
+				res = -ENOMEM;
+				goto error;
+			}
+			array = tmp;
+		}
+		res = corpus_parse(buf, &array[nr]);
+		if (res < 0) {
+			fprintf(stderr, "ERROR: %s:%u: Malformed corpus entry\n",
+				path, line);
+			goto error;
+		}
+		if (res) {
+			array[nr].line = line;
+			nr++;
+		}
+	}
+	fclose(fd);
+	*entries = array;
+
+	return (int)nr;
+
+error:
+	fclose(fd);
+	free(array);
+	return res;
+}
@@ -0,0 +1,49 @@
+#ifndef CORPUS_H_
+#define CORPUS_H_
+
+/* Golden frame corpus of the decoder tests and benchmarks. */
+
+#include "../es51984.h"
+
+#include <stddef.h>
+
+
+/* Maximum length of an expected result string. */
+#define CORPUS_RESULT_LEN	128
+
+/** struct corpus_entry - One raw frame and its expected decoder result.
+ * @line: The line number in the corpus file.
+ * @board: The board the frame is decoded for.
+ * @raw: The raw frame.
+ * @expected: The expected result, as formatted by corpus_format().
+ */
+struct corpus_entry {
+	unsigned int line;
+	enum es51984_board_type board;
+	struct es51984_raw_sample raw;
+	char expected[CORPUS_RESULT_LEN];
+};
+
+/** corpus_load - Load a corpus file.
+ * Returns the number of entries, or a negative error.
+ * The array is returned in *entries and must be freed by the caller.
+ *
+ * The file has one entry per line:
+ *   BOARD RAWHEX RESULT
+ * BOARD is 35xpa or unknown. RAWHEX are the 11 frame bytes in hex.
+ * Empty lines and lines starting with # are ignored.
+ */
+int corpus_load(const char *path, struct corpus_entry **entries);
+
+/** corpus_board_name - Get the corpus name of a board. */
+const char * corpus_board_name(enum es51984_board_type board);
+
+/** corpus_format - Format a decoder result.
+ * @buf: The buffer. At least CORPUS_RESULT_LEN bytes.
+ * @sample: The decoded sample.
+ * @error: The decoder error code. The sample is ignored, if nonzero.
+ */
+void corpus_format(char *buf, const struct es51984_sample *sample, int error);
+
+
+#endif /* CORPUS_H_ */
@@ -0,0 +1,235 @@
+/*
+ *   Multimeter measurement
+ *   Decoder microbenchmark
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "corpus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* Number of frames per benchmark run. */
+#define BENCH_FRAMES	(1u << 20)
+/* Number of runs. The fastest run is reported. */
+#define BENCH_RUNS	5
+/* Number of samples per es51984_get_samples() call. */
+#define BENCH_BATCH	64
+
+struct bench_data {
+	struct es51984_raw_sample *raw;
+	struct es51984_sample *samples;
+	int32_t *counts;
+	int *errors;
+	char capture[64];
+};
+
+static volatile unsigned long bench_sink;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_check(struct bench_data *d)
+{
+	bench_sink += es51984_check_frames(d->raw, BENCH_FRAMES, d->counts);
+}
+
+static void bench_decode(struct bench_data *d)
+{
+	bench_sink += es51984_decode_frames(ES51984_BOARD_AMPROBE_35XPA,
+					    d->raw, BENCH_FRAMES,
+					    d->samples, d->errors);
+}
+
+static void bench_units(struct bench_data *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_FRAMES; i++)
+		bench_sink += (unsigned long)es51984_get_units(&d->samples[i])[0];
+}
+
+/* Decode the capture through the stream parser. */
+static void bench_stream(struct bench_data *d, int batch)
+{
+	const struct es51984_raw_sample *frames;
+	struct es51984 *es;
+	unsigned int nr = 0;
+	int res;
+
+	es = es51984_init_replay(d->capture, 0);
+	if (!es || es51984_sync(es)) {
+		fprintf(stderr, "ERROR: Failed to open the replay.\n");
+		exit(1);
+	}
+	while (1) {
+		if (batch > 1) {
+			res = es51984_peek_frames(es, &frames, BENCH_BATCH, 0);
+			if (res > 0)
+				es51984_release_frames(es, (unsigned int)res);
+		} else if (batch) {
+			res = es51984_get_samples(es, d->samples, d->errors,
+						  BENCH_BATCH, 0);
+		} else {
+			res = es51984_get_sample(es, &d->samples[0], 0, 0);
+			res = res ? res : 1;
+		}
+		if (res < 0)
+			break;
+		nr += (unsigned int)res;
+	}
+	es51984_exit(es);
+	bench_sink += nr;
+}
+
+static void bench_stream_single(struct bench_data *d)
+{
+	bench_stream(d, 0);
+}
+
+static void bench_stream_batch(struct bench_data *d)
+{
+	bench_stream(d, 1);
+}
+
+static void bench_stream_peek(struct bench_data *d)
+{
+	bench_stream(d, 2);
+}
+
+static void run(const char *name, struct bench_data *d,
+		void (*func)(struct bench_data *d))
+{
+	int64_t start, t, best = INT64_MAX;
+	unsigned int i;
+
+	for (i = 0; i < BENCH_RUNS; i++) {
+		start = now_ns();
+		func(d);
+		t = now_ns() - start;
+		if (t < best)
+			best = t;
+	}
+	printf("%-36s %8.2f ns/frame\n", name,
+	       (double)best / (double)BENCH_FRAMES);
+}
+
+static int write_capture(struct bench_data *d)
+{
+	struct es51984_capture_header hdr;
+	struct es51984_capture_record rec;
+	unsigned int i;
+	FILE *fd;
+	int tmp;
+
+	strcpy(d->capture, "/tmp/es51984-bench-XXXXXX");
+	tmp = mkstemp(d->capture);
+	if (tmp < 0)
+		return -EIO;
+	fd = fdopen(tmp, "w");
+	if (!fd) {
+		close(tmp);
+		return -EIO;
+	}
+	memcpy(hdr.magic, ES51984_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(ES51984_CAPTURE_VERSION);
+	hdr.board = htole32(ES51984_BOARD_AMPROBE_35XPA);
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+	for (i = 0; i < BENCH_FRAMES; i++) {
+		rec.timestamp = htole64((uint64_t)i * 1000000);
+		rec.raw = d->raw[i];
+		fwrite(&rec, sizeof(rec), 1, fd);
+	}
+	if (fclose(fd))
+		return -EIO;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct corpus_entry *entries;
+	struct bench_data d;
+	unsigned int i, j, nr_valid = 0;
+	int nr, err = 1;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: decode_bench CORPUS\n");
+		return 1;
+	}
+	nr = corpus_load(argv[1], &entries);
+	if (nr < 0)
+		return 1;
+
+	/* The benchmark stream consists of the valid 35XP-A frames
+	 * of the corpus, repeated. */
+	for (i = 0; i < (unsigned int)nr; i++) {
+		if (entries[i].board == ES51984_BOARD_AMPROBE_35XPA &&
+		    strcmp(entries[i].expected, "error") != 0)
+			entries[nr_valid++] = entries[i];
+	}
+	if (!nr_valid) {
+		fprintf(stderr, "ERROR: No valid frames in the corpus.\n");
+		goto out;
+	}
+
+	memset(&d, 0, sizeof(d));
+	d.raw = calloc(BENCH_FRAMES, sizeof(*d.raw));
+	d.samples = calloc(BENCH_FRAMES, sizeof(*d.samples));
+	d.counts = calloc(BENCH_FRAMES, sizeof(*d.counts));
+	d.errors = calloc(BENCH_FRAMES, sizeof(*d.errors));
+	if (!d.raw || !d.samples || !d.counts || !d.errors) {
+		fprintf(stderr, "Out of memory\n");
+		goto out_free;
+	}
+	for (i = 0, j = 0; i < BENCH_FRAMES; i++, j = (j + 1) % nr_valid)
+		d.raw[i] = entries[j].raw;
+	if (write_capture(&d)) {
+		fprintf(stderr, "ERROR: Failed to write the capture.\n");
+		goto out_unlink;
+	}
+
+	printf("%u frames, %u distinct, best of %u runs\n",
+	       BENCH_FRAMES, nr_valid, BENCH_RUNS);
+	run("es51984_check_frames", &d, bench_check);
+	run("es51984_decode_frames", &d, bench_decode);
+	run("es51984_get_units", &d, bench_units);
+	run("es51984_get_sample (replay)", &d, bench_stream_single);
+	run("es51984_get_samples (replay)", &d, bench_stream_batch);
+	run("es51984_peek_frames (replay)", &d, bench_stream_peek);
+	err = 0;
+
+out_unlink:
+	if (d.capture[0])
+		unlink(d.capture);
+out_free:
+	free(d.raw);
+	free(d.samples);
+	free(d.counts);
+	free(d.errors);
+out:
+	free(entries);
+	return err;
+}
@@ -0,0 +1,663 @@
+/*
+ *   Multimeter measurement
+ *   Decoder test against the golden frame corpus
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "corpus.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+
+/* Maximum number of reported mismatches per check. */
+#define MAX_REPORTS	10
+/* Number of frames per es51984_peek_frames() call. */
+#define PEEK_BATCH	7
+/* Length of the garbage stream of the sync timeout check in ms.
+ * It is much longer than the 3 s sync timeout. */
+#define GARBAGE_MS	10000
+
+static unsigned int nr_failures;
+
+static void report(const char *check, const struct corpus_entry *e,
+		   const char *result)
+{
+	nr_failures++;
+	if (nr_failures > MAX_REPORTS)
+		return;
+	fprintf(stderr, "FAIL (%s) line %u:\n"
+		"  expected: %s\n"
+		"  got:      %s\n",
+		check, e->line, e->expected, result);
+}
+
+/* Compare the measurement fields of two samples.
+ * The value is compared bit by bit. The arrival times are ignored. */
+static bool samples_equal(const struct es51984_sample *a,
+			  const struct es51984_sample *b)
+{
+	return a->function == b->function &&
+	       memcmp(&a->value, &b->value, sizeof(a->value)) == 0 &&
+	       a->count == b->count &&
+	       a->exponent == b->exponent &&
+	       a->range == b->range &&
+	       a->dc_mode == b->dc_mode &&
+	       a->auto_mode == b->auto_mode &&
+	       a->overflow == b->overflow &&
+	       a->degree == b->degree &&
+	       a->batt_low == b->batt_low &&
+	       a->hold == b->hold &&
+	       a->board == b->board;
+}
+
+/* Decode every entry by itself.
+ * The valid samples also go through the compact form. */
+static void check_single(const struct corpus_entry *entries, unsigned int nr)
+{
+	struct es51984_sample sample, unpacked;
+	struct es51984_packed_sample packed;
+	char result[CORPUS_RESULT_LEN];
+	unsigned int i;
+	int error;
+
+	for (i = 0; i < nr; i++) {
+		es51984_decode_frames(entries[i].board, &entries[i].raw, 1,
+				      &sample, &error);
+		corpus_format(result, &sample, error);
+		if (strcmp(result, entries[i].expected))
+			report("single", &entries[i], result);
+		if (error)
+			continue;
+
+		if (es51984_pack_sample(&packed, &sample)) {
+			report("packed", &entries[i], "not packable");
+			continue;
+		}
+		es51984_unpack_sample(&unpacked, &packed);
+		corpus_format(result, &unpacked, 0);
+		if (strcmp(result, entries[i].expected) ||
+		    !samples_equal(&unpacked, &sample))
+			report("packed", &entries[i], result);
+	}
+}
+
+/* Decode all entries of a board in one batch. */
+static int check_batch(const struct corpus_entry *entries, unsigned int nr,
+		       enum es51984_board_type board)
+{
+	struct es51984_raw_sample *raw;
+	struct es51984_sample *samples;
+	char result[CORPUS_RESULT_LEN];
+	unsigned int i, count = 0;
+	int *errors;
+	int err = -ENOMEM;
+
+	raw = calloc(nr, sizeof(*raw));
+	samples = calloc(nr, sizeof(*samples));
+	errors = calloc(nr, sizeof(*errors));
+	if (!raw || !samples || !errors)
+		goto out;
+
+	for (i = 0; i < nr; i++) {
+		if (entries[i].board == board)
+			raw[count++] = entries[i].raw;
+	}
+	es51984_decode_frames(board, raw, count, samples, errors);
+	for (i = 0, count = 0; i < nr; i++) {
+		if (entries[i].board != board)
+			continue;
+		corpus_format(result, &samples[count], errors[count]);
+		if (strcmp(result, entries[i].expected))
+			report("batch", &entries[i], result);
+		count++;
+	}
+	err = 0;
+out:
+	free(raw);
+	free(samples);
+	free(errors);
+	return err;
+}
+
+/* Write the valid entries of a board to a capture file.
+ * If garbage is set, a bad frame or line noise is inserted
+ * after every third frame. */
+static int write_capture(const char *path, const struct corpus_entry *entries,
+			 unsigned int nr, enum es51984_board_type board,
+			 int garbage)
+{
+	static const uint8_t noise[] = {
+		0xAA, 0x55, 0x0D, 0x00, 0xFF, 0x31, 0x0A, 0x33, 0x7E, 0x0D, 0x80,
+	};
+	struct es51984_capture_header hdr;
+	struct es51984_capture_record rec;
+	unsigned int i, count = 0;
+	FILE *fd;
+
+	fd = fopen(path, "w");
+	if (!fd)
+		return -EIO;
+	memcpy(hdr.magic, ES51984_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(ES51984_CAPTURE_VERSION);
+	hdr.board = htole32((uint32_t)board);
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+	for (i = 0; i < nr; i++) {
+		if (entries[i].board != board ||
+		    strcmp(entries[i].expected, "error") == 0)
+			continue;
+		rec.timestamp = htole64((uint64_t)i * 1000000);
+		rec.raw = entries[i].raw;
+		fwrite(&rec, sizeof(rec), 1, fd);
+		if (!garbage || ++count % 3)
+			continue;
+		if (count % 2) {
+			/* A plausible frame with an invalid range code. */
+			rec.raw.range = 0x3F;
+		} else {
+			memcpy(&rec.raw, noise, sizeof(rec.raw));
+		}
+		fwrite(&rec, sizeof(rec), 1, fd);
+	}
+	if (fclose(fd))
+		return -EIO;
+
+	return 0;
+}
+
+/* Replay a capture. Optionally record it at the same time.
+ * Returns the number of valid samples or a negative error code. */
+static int replay_samples(const char *path, const char *record,
+			  struct es51984_sample *samples, unsigned int nr)
+{
+	struct es51984 *es;
+	unsigned int count = 0;
+	int err;
+
+	es = es51984_init_replay(path, 0);
+	if (!es)
+		return -EIO;
+	err = record ? es51984_record(es, record) : 0;
+	if (!err)
+		err = es51984_sync(es);
+	while (!err && count < nr) {
+		err = es51984_get_sample(es, &samples[count], 1, 0);
+		if (!err)
+			count++;
+		else if (err == -EBADMSG)
+			err = 0;
+	}
+	es51984_exit(es);
+	if (err && err != -ENODATA)
+		return err;
+
+	return (int)count;
+}
+
+/* Record a replay with bad frames and line noise. Replaying the
+ * recording must yield the same samples without any bad frames. */
+static int check_record(const struct corpus_entry *entries, unsigned int nr,
+			enum es51984_board_type board)
+{
+	struct es51984_sample *first, *second;
+	char path[] = "/tmp/es51984-corpus-XXXXXX";
+	char record[] = "/tmp/es51984-record-XXXXXX";
+	char result[CORPUS_RESULT_LEN], expected[CORPUS_RESULT_LEN];
+	struct stat st;
+	unsigned int i;
+	int fd, nr_first, nr_second, err = -ENOMEM;
+
+	first = calloc(nr, sizeof(*first));
+	second = calloc(nr, sizeof(*second));
+	if (!first || !second)
+		goto out_free;
+	err = -EIO;
+	fd = mkstemp(path);
+	if (fd < 0)
+		goto out_free;
+	close(fd);
+	fd = mkstemp(record);
+	if (fd < 0)
+		goto out_unlink;
+	close(fd);
+
+	err = write_capture(path, entries, nr, board, 1);
+	if (err)
+		goto out_unlink;
+	nr_first = replay_samples(path, record, first, nr);
+	if (nr_first < 0) {
+		err = nr_first;
+		goto out_unlink;
+	}
+	nr_second = replay_samples(record, NULL, second, nr);
+	if (nr_second < 0) {
+		err = nr_second;
+		goto out_unlink;
+	}
+	if (stat(record, &st)) {
+		err = -EIO;
+		goto out_unlink;
+	}
+	err = 0;
+
+	/* Each valid frame must be recorded exactly once. */
+	if ((size_t)st.st_size != sizeof(struct es51984_capture_header) +
+	    (size_t)nr_first * sizeof(struct es51984_capture_record)) {
+		fprintf(stderr, "FAIL (record): %lld bytes recorded for %d samples\n",
+			(long long)st.st_size, nr_first);
+		nr_failures++;
+		goto out_unlink;
+	}
+	if (nr_first != nr_second) {
+		fprintf(stderr, "FAIL (record): %d samples recorded, %d replayed\n",
+			nr_first, nr_second);
+		nr_failures++;
+		goto out_unlink;
+	}
+	for (i = 0; i < (unsigned int)nr_first; i++) {
+		corpus_format(expected, &first[i], 0);
+		corpus_format(result, &second[i], 0);
+		if (strcmp(result, expected) ||
+		    first[i].realtime_ns != second[i].realtime_ns) {
+			fprintf(stderr, "FAIL (record) sample %u:\n"
+				"  recorded: %s\n"
+				"  replayed: %s\n", i, expected, result);
+			nr_failures++;
+			break;
+		}
+	}
+out_unlink:
+	unlink(path);
+	unlink(record);
+out_free:
+	free(first);
+	free(second);
+	return err;
+}
+
+/* Decode the valid entries of a board through the stream parser
+ * of a replay interface. */
+static int check_stream(const struct corpus_entry *entries, unsigned int nr,
+			enum es51984_board_type board)
+{
+	struct es51984_sample sample;
+	struct es51984 *es;
+	char path[] = "/tmp/es51984-corpus-XXXXXX";
+	char result[CORPUS_RESULT_LEN];
+	unsigned int i;
+	int fd, err;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -EIO;
+	close(fd);
+	err = write_capture(path, entries, nr, board, 0);
+	if (err)
+		goto out;
+	es = es51984_init_replay(path, 0);
+	if (!es) {
+		err = -EIO;
+		goto out;
+	}
+	err = es51984_sync(es);
+	if (err)
+		goto out_exit;
+	for (i = 0; i < nr; i++) {
+		if (entries[i].board != board ||
+		    strcmp(entries[i].expected, "error") == 0)
+			continue;
+		err = es51984_get_sample(es, &sample, 1, 0);
+		if (err) {
+			fprintf(stderr, "FAIL (stream) line %u: error %d\n",
+				entries[i].line, err);
+			nr_failures++;
+			break;
+		}
+		corpus_format(result, &sample, 0);
+		if (strcmp(result, entries[i].expected))
+			report("stream", &entries[i], result);
+	}
+	err = 0;
+out_exit:
+	es51984_exit(es);
+out:
+	unlink(path);
+	return err;
+}
+
+/* Read the valid entries of a board through es51984_peek_frames()
+ * and check that the untouched frames are returned. */
+static int check_peek(const struct corpus_entry *entries, unsigned int nr,
+		      enum es51984_board_type board)
+{
+	const struct es51984_raw_sample *frames;
+	struct es51984_stats stats;
+	struct es51984 *es;
+	char path[] = "/tmp/es51984-corpus-XXXXXX";
+	unsigned int i = 0, j, nr_valid = 0;
+	int fd, res, err;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return -EIO;
+	close(fd);
+	err = write_capture(path, entries, nr, board, 0);
+	if (err)
+		goto out;
+	es = es51984_init_replay(path, 0);
+	if (!es) {
+		err = -EIO;
+		goto out;
+	}
+	err = es51984_sync(es);
+	if (err)
+		goto out_exit;
+	while (1) {
+		res = es51984_peek_frames(es, &frames, PEEK_BATCH, 0);
+		if (res == -ENODATA)
+			break;
+		if (res < 0) {
+			fprintf(stderr, "FAIL (peek): error %d\n", res);
+			nr_failures++;
+			break;
+		}
+		for (j = 0; j < (unsigned int)res; j++, i++) {
+			while (i < nr && (entries[i].board != board ||
+					  strcmp(entries[i].expected, "error") == 0))
+				i++;
+			if (i >= nr ||
+			    memcmp(&frames[j], &entries[i].raw, sizeof(frames[j]))) {
+				fprintf(stderr, "FAIL (peek) line %u: frame mismatch\n",
+					i < nr ? entries[i].line : 0);
+				nr_failures++;
+				goto out_exit;
+			}
+			nr_valid++;
+		}
+		/* Release in two steps and one frame less. The last
+		 * frame must be kept for the next peek. */
+		if (res > 2) {
+			if (es51984_release_frames(es, 1) ||
+			    es51984_release_frames(es, (unsigned int)res - 2) ||
+			    es51984_release_frames(es, 2) != -EINVAL) {
+				fprintf(stderr, "FAIL (peek): partial release\n");
+				nr_failures++;
+				break;
+			}
+			i--;
+			nr_valid--;
+		} else if (es51984_release_frames(es, (unsigned int)res)) {
+			fprintf(stderr, "FAIL (peek): release\n");
+			nr_failures++;
+			break;
+		}
+	}
+	es51984_get_stats(es, &stats);
+	if (stats.frames != nr_valid) {
+		fprintf(stderr, "FAIL (peek): %llu frames released, %u expected\n",
+			(unsigned long long)stats.frames, nr_valid);
+		nr_failures++;
+	}
+	err = 0;
+out_exit:
+	es51984_exit(es);
+out:
+	unlink(path);
+	return err;
+}
+
+/* Sync to a stream that never forms a frame. The data keeps arriving
+ * at its recorded pace, so es51984_sync() must time out by itself. */
+static int check_sync_timeout(void)
+{
+	static const uint8_t noise[] = {
+		0x55, 0xAA, 0x0D, 0x31, 0x0A, 0x0D, 0x0A, 0x32, 0xFF, 0x00, 0x33,
+	};
+	struct es51984_capture_header hdr;
+	struct es51984_capture_record rec;
+	struct es51984 *es;
+	struct timespec start, end;
+	char path[] = "/tmp/es51984-garbage-XXXXXX";
+	unsigned int i;
+	int64_t elapsed_ms;
+	FILE *fd;
+	int tmp, err = -EIO;
+
+	tmp = mkstemp(path);
+	if (tmp < 0)
+		return -EIO;
+	fd = fdopen(tmp, "w");
+	if (!fd) {
+		close(tmp);
+		goto out;
+	}
+	memcpy(hdr.magic, ES51984_CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(ES51984_CAPTURE_VERSION);
+	hdr.board = htole32(ES51984_BOARD_AMPROBE_35XPA);
+	fwrite(&hdr, sizeof(hdr), 1, fd);
+	memcpy(&rec.raw, noise, sizeof(rec.raw));
+	for (i = 0; i < GARBAGE_MS / 10; i++) {
+		rec.timestamp = htole64((uint64_t)i * 10000000);
+		fwrite(&rec, sizeof(rec), 1, fd);
+	}
+	if (fclose(fd))
+		goto out;
+
+	es = es51984_init_replay(path, 1);
+	if (!es)
+		goto out;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = es51984_sync(es);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	es51984_exit(es);
+	elapsed_ms = (int64_t)(end.tv_sec - start.tv_sec) * 1000 +
+		     (end.tv_nsec - start.tv_nsec) / 1000000;
+	if (err != -ETIME || elapsed_ms >= GARBAGE_MS / 2) {
+		fprintf(stderr, "FAIL (sync): error %d after %lld ms, "
+			"expected %d\n", err, (long long)elapsed_ms, -ETIME);
+		nr_failures++;
+	}
+	err = 0;
+out:
+	unlink(path);
+	return err;
+}
+
+static int check_corpus(const char *path)
+{
+	struct corpus_entry *entries;
+	int nr, err;
+
+	nr = corpus_load(path, &entries);
+	if (nr < 0)
+		return nr;
+
+	check_single(entries, (unsigned int)nr);
+	err = check_batch(entries, (unsigned int)nr, ES51984_BOARD_UNKNOWN);
+	if (!err)
+		err = check_batch(entries, (unsigned int)nr, ES51984_BOARD_AMPROBE_35XPA);
+	if (!err)
+		err = check_stream(entries, (unsigned int)nr, ES51984_BOARD_UNKNOWN);
+	if (!err)
+		err = check_stream(entries, (unsigned int)nr, ES51984_BOARD_AMPROBE_35XPA);
+	if (!err)
+		err = check_peek(entries, (unsigned int)nr, ES51984_BOARD_UNKNOWN);
+	if (!err)
+		err = check_peek(entries, (unsigned int)nr, ES51984_BOARD_AMPROBE_35XPA);
+	if (!err)
+		err = check_record(entries, (unsigned int)nr, ES51984_BOARD_UNKNOWN);
+	if (!err)
+		err = check_record(entries, (unsigned int)nr, ES51984_BOARD_AMPROBE_35XPA);
+	if (!err)
+		err = check_sync_timeout();
+	free(entries);
+	if (err) {
+		fprintf(stderr, "ERROR: Test failed: %s\n", strerror(-err));
+		return err;
+	}
+	if (nr_failures) {
+		fprintf(stderr, "%u of %d corpus checks FAILED\n",
+			nr_failures, nr);
+		return -EINVAL;
+	}
+	printf("%d corpus entries passed.\n", nr);
+
+	return 0;
+}
+
+/* Print one generated corpus entry. */
+static void gen_entry(enum es51984_board_type board,
+		      const struct es51984_raw_sample *raw)
+{
+	struct es51984_sample sample;
+	char result[CORPUS_RESULT_LEN];
+	const uint8_t *bytes = (const uint8_t *)raw;
+	unsigned int i;
+	int error;
+
+	es51984_decode_frames(board, raw, 1, &sample, &error);
+	corpus_format(result, &sample, error);
+	printf("%s ", corpus_board_name(board));
+	for (i = 0; i < sizeof(*raw); i++)
+		printf("%02X", bytes[i]);
+	printf(" %s\n", result);
+}
+
+static void gen_frame(struct es51984_raw_sample *raw,
+		      uint8_t function, uint8_t range, unsigned int count)
+{
+	raw->range = range;
+	raw->digit3 = (uint8_t)(0x30 | (count / 1000 % 10));
+	raw->digit2 = (uint8_t)(0x30 | (count / 100 % 10));
+	raw->digit1 = (uint8_t)(0x30 | (count / 10 % 10));
+	raw->digit0 = (uint8_t)(0x30 | (count % 10));
+	raw->function = function;
+	raw->status = 0x30;
+	raw->option1 = 0x30;
+	raw->option2 = 0x30 | ES51984_OPT2_DC | ES51984_OPT2_AUTO;
+	raw->cr = '\r';
+	raw->lf = '\n';
+}
+
+/* Generate the corpus from the current decoder.
+ * Review the diff of a regenerated corpus carefully. */
+static void generate(void)
+{
+	static const unsigned int counts[] = {
+		0, 1, 9, 10, 99, 100, 999, 1000, 1234, 3999, 4000, 4999,
+	};
+	static const uint8_t status_funcs[] = {
+		ES51984_FUNC_VOLTAGE, ES51984_FUNC_TEMP, ES51984_FUNC_ADP2,
+	};
+	static const uint8_t option2s[] = {
+		0x30, 0x31, 0x32, 0x34, 0x36, 0x38, 0x3A, 0x3C, 0x3E,
+	};
+	static const uint8_t bad_nibbles[] = { 0x00, 0x20, 0x40, 0xB0, };
+	struct es51984_raw_sample raw;
+	uint8_t *bytes = (uint8_t *)&raw;
+	unsigned int board, func, range, i, j, status, opt1, opt2;
+
+	printf("# ES51984 golden frame corpus\n"
+	       "# BOARD RAWHEX RESULT\n"
+	       "# The results pin the current decoder behavior, including the\n"
+	       "# unresolved TEMP and MAN_CURRENT ranges.\n"
+	       "# Regenerate with: tests/decode_test --generate\n");
+
+	printf("\n# Every function and range code\n");
+	for (board = ES51984_BOARD_UNKNOWN; board <= ES51984_BOARD_AMPROBE_35XPA; board++) {
+		for (func = 0x30; func <= 0x3F; func++) {
+			for (range = 0x30; range <= 0x37; range++) {
+				gen_frame(&raw, (uint8_t)func, (uint8_t)range, 1234);
+				gen_entry((enum es51984_board_type)board, &raw);
+			}
+		}
+	}
+
+	printf("\n# Digit counts\n");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, counts[i]);
+		gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+		gen_frame(&raw, ES51984_FUNC_CAPACITOR, 0x30, counts[i]);
+		gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+	}
+	for (i = 1; i <= 4; i++) {
+		for (j = 0x3A; j <= 0x3F; j += 5) {
+			gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+			bytes[i] = (uint8_t)j;
+			gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+		}
+	}
+	gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+	raw.digit3 = 0x35;
+	gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+
+	printf("\n# Status, option1 and option2 codes\n");
+	for (i = 0; i < sizeof(status_funcs) / sizeof(status_funcs[0]); i++) {
+		for (status = 0x30; status <= 0x3F; status++) {
+			for (opt1 = 0x30; opt1 <= 0x38; opt1 += 8) {
+				for (j = 0; j < sizeof(option2s) / sizeof(option2s[0]); j++) {
+					opt2 = option2s[j];
+					gen_frame(&raw, status_funcs[i], 0x30, 1234);
+					raw.status = (uint8_t)status;
+					raw.option1 = (uint8_t)opt1;
+					raw.option2 = (uint8_t)opt2;
+					gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+				}
+			}
+		}
+	}
+
+	printf("\n# Bad high nibbles and terminations\n");
+	for (i = 0; i < sizeof(raw) - 2; i++) {
+		for (j = 0; j < sizeof(bad_nibbles); j++) {
+			gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+			bytes[i] = (uint8_t)(bad_nibbles[j] | (bytes[i] & 0x0F));
+			gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+		}
+	}
+	gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+	raw.cr = '\n';
+	gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+	gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+	raw.lf = '\r';
+	gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+	gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+	raw.cr = 0x30;
+	gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+	gen_frame(&raw, ES51984_FUNC_VOLTAGE, 0x30, 1234);
+	raw.lf = 0x30;
+	gen_entry(ES51984_BOARD_AMPROBE_35XPA, &raw);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 2 && strcmp(argv[1], "--generate") == 0) {
+		generate();
+		return 0;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "Usage: decode_test CORPUS\n"
+				"       decode_test --generate > CORPUS\n");
+		return 1;
+	}
+
+	return check_corpus(argv[1]) ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+/*
+ *   Multimeter measurement
+ *   DEVICE[:BOARD] argument parsing test
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "../devspec.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static const struct {
+	const char *spec;
+	const char *path;
+	enum es51984_board_type board;
+} devspec_tests[] = {
+	{ "/dev/ttyUSB0", "/dev/ttyUSB0", ES51984_BOARD_AMPROBE_35XPA, },
+	{ "/dev/ttyUSB0:35xpa", "/dev/ttyUSB0", ES51984_BOARD_AMPROBE_35XPA, },
+	{ "/dev/ttyUSB0:unknown", "/dev/ttyUSB0", ES51984_BOARD_UNKNOWN, },
+	{ "/dev/serial/by-path/pci-0000:00:14.0-usb-0:1:1.0-port0",
+	  "/dev/serial/by-path/pci-0000:00:14.0-usb-0:1:1.0-port0",
+	  ES51984_BOARD_AMPROBE_35XPA, },
+	{ "/dev/serial/by-path/pci-0000:00:14.0-usb-0:1:1.0-port0:unknown",
+	  "/dev/serial/by-path/pci-0000:00:14.0-usb-0:1:1.0-port0",
+	  ES51984_BOARD_UNKNOWN, },
+	{ "capture:", "capture:", ES51984_BOARD_AMPROBE_35XPA, },
+};
+
+int main(void)
+{
+	enum es51984_board_type board;
+	char spec[128];
+	unsigned int i, nr_failures = 0;
+
+	for (i = 0; i < sizeof(devspec_tests) / sizeof(devspec_tests[0]); i++) {
+		strcpy(spec, devspec_tests[i].spec);
+		parse_device_spec(spec, &board);
+		if (strcmp(spec, devspec_tests[i].path) ||
+		    board != devspec_tests[i].board) {
+			fprintf(stderr, "FAIL: %s: got %s board %d\n",
+				devspec_tests[i].spec, spec, (int)board);
+			nr_failures++;
+		}
+	}
+	if (nr_failures)
+		return 1;
+	printf("%u device specs passed.\n", i);
+
+	return 0;
+}
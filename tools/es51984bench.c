@@ -0,0 +1,462 @@
+/*
+ *   Multimeter measurement
+ *   ES51984 end-to-end benchmark
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "simgen.h"
+#include "../es51984.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+
+/* Number of samples per es51984_get_samples() call in batch mode. */
+#define BENCH_BATCH		64
+
+enum bench_mode {
+	BENCH_MODE_SAMPLE,	/* es51984_get_sample(), blocking */
+	BENCH_MODE_TIMEOUT,	/* es51984_get_sample_timeout() */
+	BENCH_MODE_BATCH,	/* es51984_get_samples() */
+};
+
+static struct {
+	double rate;
+	unsigned long count;
+	enum bench_mode mode;
+	struct simgen_opts gen;
+} cmdline;
+
+struct bench {
+	int master_fd;
+	int slave_fd;
+	char name[256];
+
+	/* Write time of the last frame with a given count.
+	 * Written by the writer thread, read by the reader. */
+	int64_t sent_ns[SIMGEN_COUNTS];
+
+	int writer_done;
+	uint64_t nr_garbage;
+	uint64_t nr_truncated;
+
+	int64_t *latencies;
+	unsigned long nr_latencies;
+	unsigned long nr_samples;
+	unsigned long nr_errors;
+	int64_t last_ns;	/* Return time of the last sample */
+
+	/* Corruption recovery */
+	unsigned long nr_bad;	/* Bad frames reported */
+	int64_t bad_ns;		/* First bad frame since the last sample */
+	int64_t *recoveries;	/* Bad frame to next sample times */
+	unsigned long nr_recoveries;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t thread_cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	return ((int64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+	       ((int64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+static void * writer_thread(void *arg)
+{
+	struct bench *b = arg;
+	struct simgen gen;
+	struct timespec next;
+	uint8_t buf[SIMGEN_MAX_LEN];
+	int64_t period_ns = 0, t;
+	unsigned long i;
+	size_t len;
+	unsigned int count;
+
+	simgen_init(&gen, &cmdline.gen);
+	if (cmdline.rate > 0.0)
+		period_ns = (int64_t)(1000000000.0 / cmdline.rate);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (i = 0; i < cmdline.count; i++) {
+		if (period_ns) {
+			t = (int64_t)next.tv_sec * 1000000000 + next.tv_nsec + period_ns;
+			next.tv_sec = (time_t)(t / 1000000000);
+			next.tv_nsec = (long)(t % 1000000000);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &next, NULL) == EINTR)
+				;
+		}
+		count = (unsigned int)(gen.seq % SIMGEN_COUNTS);
+		len = simgen_next(&gen, buf);
+		__atomic_store_n(&b->sent_ns[count], now_ns(), __ATOMIC_RELEASE);
+		if (simgen_write(b->master_fd, buf, len)) {
+			fprintf(stderr, "ERROR: Failed to write to pty.\n");
+			break;
+		}
+	}
+	b->nr_garbage = gen.nr_garbage;
+	b->nr_truncated = gen.nr_truncated;
+	__atomic_store_n(&b->writer_done, 1, __ATOMIC_RELEASE);
+
+	/* Hang up, after the reader had time to drain the pty.
+	 * That ends a blocking read. */
+	sleep(1);
+	close(b->master_fd);
+	b->master_fd = -1;
+
+	return NULL;
+}
+
+/* Account one returned sample. */
+static void bench_sample(struct bench *b, const struct es51984_sample *sample,
+			 int64_t t)
+{
+	int32_t count = sample->count < 0 ? -sample->count : sample->count;
+	int64_t sent;
+
+	b->nr_samples++;
+	b->last_ns = t;
+	if (b->bad_ns) {
+		b->recoveries[b->nr_recoveries++] = t - b->bad_ns;
+		b->bad_ns = 0;
+	}
+	/* Functions without a value report a count of zero.
+	 * That doesn't identify the frame. */
+	if (sample->overflow || count == 0 || count >= SIMGEN_COUNTS)
+		return;
+	sent = __atomic_load_n(&b->sent_ns[count], __ATOMIC_ACQUIRE);
+	/* With noise the count doesn't identify the frame. */
+	if (!sent || cmdline.gen.noise)
+		return;
+	if (b->nr_latencies < cmdline.count)
+		b->latencies[b->nr_latencies++] = t - sent;
+}
+
+/* Read samples until the stream stays silent or hangs up. */
+static int bench_read(struct bench *b, struct es51984 *es)
+{
+	struct es51984_sample samples[BENCH_BATCH];
+	int errors[BENCH_BATCH];
+	int i, res;
+	int64_t t;
+
+	while (b->nr_samples < cmdline.count) {
+		switch (cmdline.mode) {
+		case BENCH_MODE_SAMPLE:
+			res = es51984_get_sample(es, &samples[0], 1, 0);
+			errors[0] = res;
+			res = res ? res : 1;
+			break;
+		case BENCH_MODE_TIMEOUT:
+			res = es51984_get_sample_timeout(es, &samples[0], 1000, 0);
+			errors[0] = res;
+			res = res ? res : 1;
+			break;
+		case BENCH_MODE_BATCH:
+		default:
+			res = es51984_get_samples(es, samples, errors,
+						  BENCH_BATCH, 1000);
+			break;
+		}
+		t = now_ns();
+		if (res == -EBADMSG) {
+			errors[0] = res;
+			res = 1;
+		} else if (res < 0) {
+			/* Silence or hangup. The writer is done. */
+			if (__atomic_load_n(&b->writer_done, __ATOMIC_ACQUIRE) &&
+			    (res == -EAGAIN || res == -EIO))
+				break;
+			return res;
+		}
+		for (i = 0; i < res; i++) {
+			if (errors[i] == -EBADMSG) {
+				b->nr_bad++;
+				if (!b->bad_ns)
+					b->bad_ns = t;
+				continue;
+			}
+			if (errors[i]) {
+				b->nr_errors++;
+				continue;
+			}
+			bench_sample(b, &samples[i], t);
+		}
+	}
+
+	return 0;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Get a percentile of a sorted array of nanosecond times. */
+static double percentile_us(const int64_t *times, unsigned long nr, double p)
+{
+	unsigned long i;
+
+	if (!nr)
+		return 0.0;
+	i = (unsigned long)(p / 100.0 * (double)(nr - 1) + 0.5);
+	return (double)times[i] / 1000.0;
+}
+
+static int benchmark(void)
+{
+	struct bench *b;
+	struct es51984 *es;
+	pthread_t writer;
+	int64_t start, end, cpu_start, cpu_end;
+	unsigned long syscalls;
+	uint64_t intact;
+	double frames;
+	int err = -ENOMEM;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		goto out;
+	b->latencies = calloc(cmdline.count, sizeof(b->latencies[0]));
+	b->recoveries = calloc(cmdline.count, sizeof(b->recoveries[0]));
+	if (!b->latencies || !b->recoveries)
+		goto out_free;
+
+	b->master_fd = simgen_open_pty(b->name, sizeof(b->name), &b->slave_fd);
+	if (b->master_fd < 0) {
+		err = b->master_fd;
+		goto out_free;
+	}
+	es = es51984_init(ES51984_BOARD_AMPROBE_35XPA, b->name);
+	if (!es) {
+		err = -ENODEV;
+		goto out_close;
+	}
+
+	/* Prime the stream so that the initial sync succeeds. */
+	start = now_ns();
+	err = pthread_create(&writer, NULL, writer_thread, b);
+	if (err) {
+		err = -err;
+		goto out_exit;
+	}
+	err = es51984_sync(es);
+	if (err)
+		goto out_join;
+
+	cpu_start = thread_cpu_ns();
+	err = bench_read(b, es);
+	cpu_end = thread_cpu_ns();
+	end = b->last_ns ? b->last_ns : now_ns();
+	syscalls = es51984_get_syscalls(es);
+	pthread_join(writer, NULL);
+	if (err)
+		goto out_exit;
+
+	frames = b->nr_samples ? (double)b->nr_samples : 1.0;
+	printf("samples:         %lu of %lu frames\n", b->nr_samples, cmdline.count);
+	printf("errors:          %lu\n", b->nr_errors);
+	printf("frames/s:        %.1f\n",
+	       (double)b->nr_samples / ((double)(end - start) / 1e9));
+	printf("syscalls/frame:  %.3f\n", (double)syscalls / frames);
+	printf("CPU/frame:       %.3f us\n",
+	       (double)(cpu_end - cpu_start) / frames / 1000.0);
+	if (b->nr_latencies) {
+		qsort(b->latencies, b->nr_latencies, sizeof(b->latencies[0]),
+		      cmp_int64);
+		printf("latency (us):    p50 %.1f  p90 %.1f  p99 %.1f  "
+		       "p99.9 %.1f  max %.1f\n",
+		       percentile_us(b->latencies, b->nr_latencies, 50.0),
+		       percentile_us(b->latencies, b->nr_latencies, 90.0),
+		       percentile_us(b->latencies, b->nr_latencies, 99.0),
+		       percentile_us(b->latencies, b->nr_latencies, 99.9),
+		       percentile_us(b->latencies, b->nr_latencies, 100.0));
+	}
+	if (b->nr_garbage || b->nr_truncated || b->nr_bad) {
+		/* Every frame that wasn't truncated should be decoded. */
+		intact = cmdline.count - b->nr_truncated;
+		printf("corruptions:     %llu garbage, %llu truncated\n",
+		       (unsigned long long)b->nr_garbage,
+		       (unsigned long long)b->nr_truncated);
+		printf("bad frames:      %lu\n", b->nr_bad);
+		printf("recovered:       %lu times\n", b->nr_recoveries);
+		printf("lost frames:     %lld of %llu intact\n",
+		       (long long)intact - (long long)b->nr_samples,
+		       (unsigned long long)intact);
+		qsort(b->recoveries, b->nr_recoveries, sizeof(b->recoveries[0]),
+		      cmp_int64);
+		printf("recovery (us):   p50 %.1f  p99 %.1f  max %.1f\n",
+		       percentile_us(b->recoveries, b->nr_recoveries, 50.0),
+		       percentile_us(b->recoveries, b->nr_recoveries, 99.0),
+		       percentile_us(b->recoveries, b->nr_recoveries, 100.0));
+	}
+	goto out_exit;
+
+out_join:
+	pthread_join(writer, NULL);
+out_exit:
+	es51984_exit(es);
+out_close:
+	close(b->slave_fd);
+	if (b->master_fd >= 0)
+		close(b->master_fd);
+out_free:
+	free(b->latencies);
+	free(b->recoveries);
+	free(b);
+out:
+	if (err)
+		fprintf(stderr, "ERROR: Benchmark failed: %s\n", strerror(-err));
+	return err;
+}
+
+static void usage(void)
+{
+	printf("ES51984 end-to-end benchmark\n\n"
+	       "  Usage: es51984bench [OPTIONS]\n"
+	       "\n"
+	       "  Feeds simulated frames through a pseudo terminal into the\n"
+	       "  es51984 library and measures throughput, syscalls and CPU time\n"
+	       "  per frame, and the latency from the write of a frame to the\n"
+	       "  return of its sample.\n"
+	       "  With injected corruption it also reports the recovery from\n"
+	       "  bad frames: the lost intact frames and the time from a bad\n"
+	       "  frame to the next decoded sample.\n"
+	       "\n"
+	       "Options:\n"
+	       "  -r|--rate FPS        Frames per second. 0 is unthrottled. Default: 1000\n"
+	       "  -n|--count N         Number of frames. Default: 10000\n"
+	       "  -m|--mode MODE       Read API: sample, timeout or batch. Default: batch\n"
+	       "  -a|--all             Cycle through all functions and ranges\n"
+	       "  -N|--noise COUNTS    Add up to +-COUNTS of noise to the values\n"
+	       "                       This disables the latency measurement.\n"
+	       "  -g|--garbage P       Insert garbage before a frame with probability P\n"
+	       "  -t|--truncate P      Truncate a frame with probability P\n"
+	       "  -h|--help            Print this help text\n"
+	);
+}
+
+static int parse_args(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "rate", required_argument, NULL, 'r', },
+		{ "count", required_argument, NULL, 'n', },
+		{ "mode", required_argument, NULL, 'm', },
+		{ "all", no_argument, NULL, 'a', },
+		{ "noise", required_argument, NULL, 'N', },
+		{ "garbage", required_argument, NULL, 'g', },
+		{ "truncate", required_argument, NULL, 't', },
+		{ "help", no_argument, NULL, 'h', },
+		{ NULL, },
+	};
+	int c, idx;
+
+	memset(&cmdline, 0, sizeof(cmdline));
+	cmdline.rate = 1000.0;
+	cmdline.count = 10000;
+	cmdline.mode = BENCH_MODE_BATCH;
+
+	while (1) {
+		c = getopt_long(argc, argv, "r:n:m:aN:g:t:h",
+				long_options, &idx);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'r':
+			if (sscanf(optarg, "%lf", &cmdline.rate) != 1) {
+				fprintf(stderr, "ERROR: Invalid --rate value\n");
+				return -1;
+			}
+			break;
+		case 'n':
+			if (sscanf(optarg, "%lu", &cmdline.count) != 1 ||
+			    !cmdline.count) {
+				fprintf(stderr, "ERROR: Invalid --count value\n");
+				return -1;
+			}
+			break;
+		case 'm':
+			if (strcmp(optarg, "sample") == 0)
+				cmdline.mode = BENCH_MODE_SAMPLE;
+			else if (strcmp(optarg, "timeout") == 0)
+				cmdline.mode = BENCH_MODE_TIMEOUT;
+			else if (strcmp(optarg, "batch") == 0)
+				cmdline.mode = BENCH_MODE_BATCH;
+			else {
+				fprintf(stderr, "ERROR: Invalid --mode value\n");
+				return -1;
+			}
+			break;
+		case 'a':
+			cmdline.gen.all_functions = true;
+			break;
+		case 'N':
+			if (sscanf(optarg, "%u", &cmdline.gen.noise) != 1) {
+				fprintf(stderr, "ERROR: Invalid --noise value\n");
+				return -1;
+			}
+			break;
+		case 'g':
+			if (sscanf(optarg, "%lf", &cmdline.gen.garbage) != 1) {
+				fprintf(stderr, "ERROR: Invalid --garbage value\n");
+				return -1;
+			}
+			break;
+		case 't':
+			if (sscanf(optarg, "%lf", &cmdline.gen.truncate) != 1) {
+				fprintf(stderr, "ERROR: Invalid --truncate value\n");
+				return -1;
+			}
+			break;
+		case 'h':
+			usage();
+			return 1;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int err;
+
+	err = parse_args(argc, argv);
+	if (err > 0)
+		return 0;
+	if (err)
+		return 1;
+
+	return benchmark() ? 1 : 0;
+}
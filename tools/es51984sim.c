@@ -0,0 +1,185 @@
+/*
+ *   Multimeter measurement
+ *   ES51984 serial stream simulator
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "simgen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+
+
+static struct {
+	double rate;
+	unsigned long count;
+	struct simgen_opts gen;
+} cmdline;
+
+/* Advance an absolute CLOCK_MONOTONIC time by ns nanoseconds. */
+static void timespec_add(struct timespec *ts, int64_t ns)
+{
+	int64_t t = (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec + ns;
+
+	ts->tv_sec = (time_t)(t / 1000000000);
+	ts->tv_nsec = (long)(t % 1000000000);
+}
+
+static int simulate(void)
+{
+	struct simgen gen;
+	struct timespec next;
+	uint8_t buf[SIMGEN_MAX_LEN];
+	char name[256];
+	int64_t period_ns = 0;
+	unsigned long i;
+	int fd, slave_fd, err;
+	size_t len;
+
+	fd = simgen_open_pty(name, sizeof(name), &slave_fd);
+	if (fd < 0)
+		return fd;
+	printf("%s\n", name);
+	fflush(stdout);
+
+	simgen_init(&gen, &cmdline.gen);
+	if (cmdline.rate > 0.0)
+		period_ns = (int64_t)(1000000000.0 / cmdline.rate);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (i = 0; !cmdline.count || i < cmdline.count; i++) {
+		if (period_ns) {
+			timespec_add(&next, period_ns);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					       &next, NULL) == EINTR)
+				;
+		}
+		len = simgen_next(&gen, buf);
+		err = simgen_write(fd, buf, len);
+		if (err) {
+			fprintf(stderr, "ERROR: Failed to write to pty.\n");
+			break;
+		}
+	}
+	/* Give the reader time to drain the pty. */
+	sleep(1);
+	close(slave_fd);
+	close(fd);
+
+	return 0;
+}
+
+static void usage(void)
+{
+	printf("ES51984 serial stream simulator\n\n"
+	       "  Usage: es51984sim [OPTIONS]\n"
+	       "\n"
+	       "  Creates a pseudo terminal, prints its name and emits\n"
+	       "  ES51984 frames to it.\n"
+	       "\n"
+	       "Options:\n"
+	       "  -r|--rate FPS        Frames per second. 0 is unthrottled. Default: 2\n"
+	       "  -n|--count N         Stop after N frames. Default: endless\n"
+	       "  -a|--all             Cycle through all functions and ranges\n"
+	       "  -N|--noise COUNTS    Add up to +-COUNTS of noise to the values\n"
+	       "  -g|--garbage P       Insert garbage before a frame with probability P\n"
+	       "  -t|--truncate P      Truncate a frame with probability P\n"
+	       "  -h|--help            Print this help text\n"
+	);
+}
+
+static int parse_args(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "rate", required_argument, NULL, 'r', },
+		{ "count", required_argument, NULL, 'n', },
+		{ "all", no_argument, NULL, 'a', },
+		{ "noise", required_argument, NULL, 'N', },
+		{ "garbage", required_argument, NULL, 'g', },
+		{ "truncate", required_argument, NULL, 't', },
+		{ "help", no_argument, NULL, 'h', },
+		{ NULL, },
+	};
+	int c, idx;
+
+	memset(&cmdline, 0, sizeof(cmdline));
+	cmdline.rate = 2.0;
+
+	while (1) {
+		c = getopt_long(argc, argv, "r:n:aN:g:t:h",
+				long_options, &idx);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'r':
+			if (sscanf(optarg, "%lf", &cmdline.rate) != 1) {
+				fprintf(stderr, "ERROR: Invalid --rate value\n");
+				return -1;
+			}
+			break;
+		case 'n':
+			if (sscanf(optarg, "%lu", &cmdline.count) != 1) {
+				fprintf(stderr, "ERROR: Invalid --count value\n");
+				return -1;
+			}
+			break;
+		case 'a':
+			cmdline.gen.all_functions = true;
+			break;
+		case 'N':
+			if (sscanf(optarg, "%u", &cmdline.gen.noise) != 1) {
+				fprintf(stderr, "ERROR: Invalid --noise value\n");
+				return -1;
+			}
+			break;
+		case 'g':
+			if (sscanf(optarg, "%lf", &cmdline.gen.garbage) != 1) {
+				fprintf(stderr, "ERROR: Invalid --garbage value\n");
+				return -1;
+			}
+			break;
+		case 't':
+			if (sscanf(optarg, "%lf", &cmdline.gen.truncate) != 1) {
+				fprintf(stderr, "ERROR: Invalid --truncate value\n");
+				return -1;
+			}
+			break;
+		case 'h':
+			usage();
+			return 1;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int err;
+
+	err = parse_args(argc, argv);
+	if (err > 0)
+		return 0;
+	if (err)
+		return 1;
+
+	return simulate() ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+/*
+ *   Multimeter measurement
+ *   ES51984 frame stream generator
+ *
+ *   Copyright (C) 2016-2018 Michael Buesch <m@bues.ch>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   as published by the Free Software Foundation; either version 2
+ *   of the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "simgen.h"
+#include "../es51984.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+
+/* Frames per function/range, if all_functions is set. */
+#define SIMGEN_FRAMES_PER_RANGE	16
+
+/* The functions of the Amprobe 35XP-A and their number of ranges.
+ * Functions without ranges have nr_ranges = 1. */
+static const struct {
+	uint8_t function;
+	uint8_t nr_ranges;
+} simgen_funcs[] = {
+	{ ES51984_FUNC_VOLTAGE, 5, },
+	{ ES51984_FUNC_UA_CURRENT, 2, },
+	{ ES51984_FUNC_MA_CURRENT, 2, },
+	{ ES51984_FUNC_AUTO_CURRENT, 2, },
+	{ ES51984_FUNC_MAN_CURRENT, 1, },
+	{ ES51984_FUNC_OHMS, 6, },
+	{ ES51984_FUNC_CONT, 1, },
+	{ ES51984_FUNC_DIODE, 1, },
+	{ ES51984_FUNC_FREQUENCY, 5, },
+	{ ES51984_FUNC_CAPACITOR, 7, },
+	{ ES51984_FUNC_TEMP, 1, },
+	{ ES51984_FUNC_ADP0, 1, },
+	{ ES51984_FUNC_ADP1, 1, },
+	{ ES51984_FUNC_ADP2, 1, },
+	{ ES51984_FUNC_ADP3, 1, },
+};
+
+static uint32_t simgen_rand(struct simgen *g)
+{
+	uint32_t x = g->rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	g->rng = x;
+
+	return x;
+}
+
+/* Random event with the given probability. */
+static bool simgen_chance(struct simgen *g, double probability)
+{
+	if (probability <= 0.0)
+		return false;
+	return (double)simgen_rand(g) / 4294967296.0 < probability;
+}
+
+void simgen_init(struct simgen *g, const struct simgen_opts *opts)
+{
+	memset(g, 0, sizeof(*g));
+	g->opts = *opts;
+	g->rng = 0x12345678;
+}
+
+/* Select the function and range of the current frame. */
+static void simgen_mode(struct simgen *g, uint8_t *function, uint8_t *range)
+{
+	unsigned int i, step;
+
+	if (!g->opts.all_functions) {
+		*function = ES51984_FUNC_VOLTAGE;
+		*range = 0;
+		return;
+	}
+	step = (unsigned int)(g->seq / SIMGEN_FRAMES_PER_RANGE);
+	for (i = 0; ; i = (i + 1) % (sizeof(simgen_funcs) / sizeof(simgen_funcs[0]))) {
+		if (step < simgen_funcs[i].nr_ranges) {
+			*function = simgen_funcs[i].function;
+			*range = (uint8_t)step;
+			return;
+		}
+		step -= simgen_funcs[i].nr_ranges;
+	}
+}
+
+size_t simgen_next(struct simgen *g, uint8_t *buf)
+{
+	struct es51984_raw_sample raw;
+	uint8_t function, range;
+	size_t len = 0, flen;
+	unsigned int i, nr;
+	int count;
+
+	simgen_mode(g, &function, &range);
+	count = (int)(g->seq % SIMGEN_COUNTS);
+	if (g->opts.noise) {
+		count += (int)(simgen_rand(g) % (2 * g->opts.noise + 1)) -
+			 (int)g->opts.noise;
+		if (count < 0)
+			count = 0;
+		if (count >= SIMGEN_COUNTS)
+			count = SIMGEN_COUNTS - 1;
+	}
+
+	raw.range = 0x30 | range;
+	raw.digit3 = (uint8_t)(0x30 | (count / 1000));
+	raw.digit2 = (uint8_t)(0x30 | (count / 100 % 10));
+	raw.digit1 = (uint8_t)(0x30 | (count / 10 % 10));
+	raw.digit0 = (uint8_t)(0x30 | (count % 10));
+	raw.function = function;
+	raw.status = 0x30;
+	raw.option1 = 0x30;
+	raw.option2 = 0x30 | ES51984_OPT2_DC | ES51984_OPT2_AUTO;
+	raw.cr = '\r';
+	raw.lf = '\n';
+
+	if (simgen_chance(g, g->opts.garbage)) {
+		nr = 1 + simgen_rand(g) % 8;
+		for (i = 0; i < nr; i++)
+			buf[len++] = (uint8_t)simgen_rand(g);
+		g->nr_garbage++;
+	}
+	flen = sizeof(raw);
+	g->last_truncated = simgen_chance(g, g->opts.truncate);
+	if (g->last_truncated) {
+		flen = 1 + simgen_rand(g) % (sizeof(raw) - 1);
+		g->nr_truncated++;
+	}
+	memcpy(buf + len, &raw, flen);
+	len += flen;
+
+	g->seq++;
+
+	return len;
+}
+
+int simgen_open_pty(char *name, size_t size, int *slave_fd)
+{
+	struct termios ios;
+	int fd, sfd;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "ERROR: Failed to open pty: %s\n",
+			strerror(errno));
+		return -ENODEV;
+	}
+	if (grantpt(fd) || unlockpt(fd) || ptsname_r(fd, name, size)) {
+		fprintf(stderr, "ERROR: Failed to set up pty: %s\n",
+			strerror(errno));
+		close(fd);
+		return -ENODEV;
+	}
+	sfd = open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (sfd < 0) {
+		fprintf(stderr, "ERROR: Failed to open %s: %s\n",
+			name, strerror(errno));
+		close(fd);
+		return -ENODEV;
+	}
+	if (tcgetattr(sfd, &ios) == 0) {
+		cfmakeraw(&ios);
+		tcsetattr(sfd, TCSANOW, &ios);
+	}
+	*slave_fd = sfd;
+
+	return fd;
+}
+
+int simgen_write(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t res;
+
+	while (len) {
+		res = write(fd, buf, len);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return -EIO;
+		}
+		buf += res;
+		len -= (size_t)res;
+	}
+
+	return 0;
+}
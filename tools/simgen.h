@@ -0,0 +1,71 @@
+#ifndef SIMGEN_H_
+#define SIMGEN_H_
+
+/* ES51984 frame stream generator for the simulator and the benchmark. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+/* Number of distinct digit counts. The count of frame N is N % SIMGEN_COUNTS,
+ * unless noise is enabled. */
+#define SIMGEN_COUNTS		4000
+
+/* Maximum length of one generated chunk. A frame plus garbage. */
+#define SIMGEN_MAX_LEN		32
+
+/** struct simgen_opts - Generator options.
+ * @all_functions: Boolean. Cycle through all functions and ranges.
+ *                 Else only emit the 4.000 V range.
+ * @noise: Add random noise of up to +-noise counts to the value.
+ * @garbage: Probability of random bytes before a frame. 0.0 to 1.0.
+ * @truncate: Probability of a truncated frame. 0.0 to 1.0.
+ */
+struct simgen_opts {
+	bool all_functions;
+	unsigned int noise;
+	double garbage;
+	double truncate;
+};
+
+struct simgen {
+	struct simgen_opts opts;
+	uint64_t seq;		/* Number of frames generated */
+	uint32_t rng;		/* xorshift state */
+
+	/* Injected corruptions */
+	uint64_t nr_garbage;	/* Frames preceded by garbage */
+	uint64_t nr_truncated;	/* Truncated frames */
+	bool last_truncated;	/* The last frame was truncated */
+};
+
+/** simgen_init - Initialize a generator. */
+void simgen_init(struct simgen *g, const struct simgen_opts *opts);
+
+/** simgen_next - Generate the next chunk of the stream.
+ * Returns the number of bytes written to buf.
+ * buf must be at least SIMGEN_MAX_LEN bytes.
+ * A chunk is one frame, possibly truncated and possibly preceded
+ * by garbage.
+ */
+size_t simgen_next(struct simgen *g, uint8_t *buf);
+
+/** simgen_open_pty - Create a pseudo terminal in raw mode.
+ * Returns the master file descriptor, or a negative error.
+ * The frames are written to the master.
+ *
+ * @name: Buffer for the name of the slave device.
+ * @size: The size of the name buffer.
+ * @slave_fd: Returns a file descriptor of the slave. Keep this open,
+ *            so that the pty survives reopening by the reader.
+ */
+int simgen_open_pty(char *name, size_t size, int *slave_fd);
+
+/** simgen_write - Write a chunk to the pty master.
+ * Returns zero on success, or a negative error.
+ */
+int simgen_write(int fd, const uint8_t *buf, size_t len);
+
+
+#endif /* SIMGEN_H_ */